@@ -0,0 +1,167 @@
+# frozen_string_literal: true
+
+# Times each phase of a diff over the pairs in bench/corpus: tokenizing
+# (TokenizedTree.new), the search (diff_ranges, which builds no change
+# sets) and materializing the change sets (the output_ns that diff reports
+# with stats: true; its allocations and GC time are those of the whole diff).
+#
+#   BENCH_ITERATIONS  timed runs per phase, the median is reported (default 10)
+#   BENCH_CASES       comma separated case names to run (default all)
+#   BENCH_OUTPUT      also write the results as JSON to this file
+#   BENCH_BASELINE    JSON from an earlier run; exits with 1 if a phase got
+#                     slower by more than BENCH_TOLERANCE (default 0.2)
+
+require 'json'
+require 'objspace'
+require 'tree_sitter/diff'
+
+module Bench
+  CORPUS_DIR = File.expand_path('corpus', __dir__)
+  LANGUAGES = { '.rb' => :ruby, '.c' => :c, '.h' => :c, '.js' => :javascript }.freeze
+  PHASES = %w[tokenize diff materialize].freeze
+
+  module_function
+
+  def parse(source, language)
+    TreeSitter::Parser.new(language).parse(source).root_node
+  end
+
+  def cases
+    only = ENV['BENCH_CASES']&.split(',')
+    Dir[File.join(CORPUS_DIR, '*/')].sort.map do |dir|
+      name = File.basename(dir)
+      next if only && !only.include?(name)
+
+      old_path, new_path = %w[old new].map { |side| Dir[File.join(dir, "#{side}.*")].first }
+      { name: name, language: LANGUAGES.fetch(File.extname(old_path)), old: old_path, new: new_path }
+    end.compact
+  end
+
+  def median(values)
+    sorted = values.sort
+    (sorted[(sorted.size - 1) / 2] + sorted[sorted.size / 2]) / 2.0
+  end
+
+  def clock
+    Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  end
+
+  # Objects and bytes allocated by one run, with the GC off so that
+  # nothing allocated is freed before it is counted
+  def allocations
+    GC.start
+    GC.disable
+    objects = GC.stat(:total_allocated_objects)
+    bytes = ObjectSpace.memsize_of_all
+    result = yield
+    [GC.stat(:total_allocated_objects) - objects, ObjectSpace.memsize_of_all - bytes, result]
+  ensure
+    GC.enable
+  end
+
+  def measure(iterations)
+    times = []
+    GC::Profiler.clear
+    GC::Profiler.enable
+    iterations.times do
+      start = clock
+      yield
+      times << clock - start
+    end
+    gc = GC::Profiler.total_time / iterations
+    GC::Profiler.disable
+    objects, bytes, = allocations { yield }
+    { 'median_s' => median(times), 'best_s' => times.min, 'gc_s' => gc,
+      'allocated_objects' => objects, 'allocated_bytes' => bytes }
+  end
+
+  def run_case(bench_case, iterations)
+    node_old = parse(File.binread(bench_case[:old]), bench_case[:language])
+    node_new = parse(File.binread(bench_case[:new]), bench_case[:language])
+
+    tokenize = measure(iterations) do
+      TreeSitter::Diff::TokenizedTree.new(node_old)
+      TreeSitter::Diff::TokenizedTree.new(node_new)
+    end
+    tokenized_old = TreeSitter::Diff::TokenizedTree.new(node_old)
+    tokenized_new = TreeSitter::Diff::TokenizedTree.new(node_new)
+    tokens = tokenized_old.size + tokenized_new.size
+
+    diff = measure(iterations) { TreeSitter::Diff.diff_ranges(tokenized_old, tokenized_new) }
+    full = measure(iterations) { TreeSitter::Diff.diff(tokenized_old, tokenized_new) }
+    output = Array.new(iterations) do
+      TreeSitter::Diff.diff(tokenized_old, tokenized_new, stats: true)
+      TreeSitter::Diff.last_stats[:output_ns] / 1e9
+    end
+    materialize = full.merge('median_s' => median(output), 'best_s' => output.min)
+
+    phases = { 'tokenize' => tokenize, 'diff' => diff, 'materialize' => materialize }
+    phases.each_value do |phase|
+      phase['tokens_per_s'] = phase['median_s'].positive? ? (tokens / phase['median_s']).round : nil
+    end
+
+    {
+      'name' => bench_case[:name],
+      'language' => bench_case[:language].to_s,
+      'tokens_old' => tokenized_old.size,
+      'tokens_new' => tokenized_new.size,
+      'change_sets' => TreeSitter::Diff.diff(tokenized_old, tokenized_new).size,
+      'phases' => phases
+    }
+  end
+
+  def report(results)
+    puts format('%-16s %-12s %10s %12s %12s %10s %12s %8s',
+                'case', 'phase', 'tokens', 'median ms', 'tokens/s', 'objects', 'bytes', 'gc ms')
+    results.each do |result|
+      PHASES.each do |name|
+        phase = result['phases'][name]
+        puts format('%-16s %-12s %10d %12.3f %12s %10d %12d %8.3f',
+                    result['name'], name, result['tokens_old'] + result['tokens_new'],
+                    phase['median_s'] * 1000, phase['tokens_per_s'] || '-',
+                    phase['allocated_objects'], phase['allocated_bytes'], phase['gc_s'] * 1000)
+      end
+    end
+  end
+
+  # Phases of cases in both runs whose median got slower than allowed
+  def regressions(results, baseline, tolerance)
+    baseline_cases = baseline['cases'].to_h { |result| [result['name'], result] }
+    results.flat_map do |result|
+      before = baseline_cases[result['name']] or next []
+      PHASES.map do |name|
+        now = result['phases'][name]['median_s']
+        was = before['phases'][name]['median_s']
+        next unless was.positive? && now > was * (1 + tolerance)
+
+        format('%s/%s: %.3fms -> %.3fms (+%.0f%%)', result['name'], name, was * 1000, now * 1000,
+               (now / was - 1) * 100)
+      end.compact
+    end
+  end
+
+  def main
+    iterations = Integer(ENV.fetch('BENCH_ITERATIONS', 10))
+    results = cases.map { |bench_case| run_case(bench_case, iterations) }
+    report(results)
+
+    output = {
+      'version' => Tokdiff::VERSION,
+      'ruby' => RUBY_DESCRIPTION,
+      'iterations' => iterations,
+      'cases' => results
+    }
+    File.write(ENV['BENCH_OUTPUT'], JSON.pretty_generate(output)) if ENV['BENCH_OUTPUT']
+
+    return unless ENV['BENCH_BASELINE']
+
+    slower = regressions(results, JSON.parse(File.read(ENV['BENCH_BASELINE'])),
+                         Float(ENV.fetch('BENCH_TOLERANCE', 0.2)))
+    return if slower.empty?
+
+    puts 'Regressions:', slower
+    exit 1
+  end
+end
+
+Bench.main if $PROGRAM_NAME == __FILE__
@@ -0,0 +1,345 @@
+/*
+Diffs two pre-tokenized files with the engine alone, for profiling
+without a Ruby interpreter:
+
+  diff_bench [options] OLD NEW
+
+Each line of a file is one token, an empty line ends a line of the
+source (used by --lines). Tokens with equal text get equal ids.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "engine.h"
+
+typedef struct {
+  TokenId *ids;
+  size_t len;
+  TokenLine *lines;
+  uint32_t lines_len;
+} TokenFile;
+
+typedef struct {
+  char *text;
+  size_t len;
+  TokenId id;
+} DictEntry;
+
+typedef struct {
+  DictEntry *data;
+  size_t capa;
+  uint32_t len;
+} Dict;
+
+static void *
+checked_realloc(void *ptr, size_t size) {
+  ptr = realloc(ptr, size);
+  if(ptr == NULL && size > 0) {
+    fprintf(stderr, "diff_bench: out of memory\n");
+    exit(1);
+  }
+  return ptr;
+}
+
+static uint64_t
+text_hash(const char *text, size_t len) {
+  uint64_t hash = 14695981039346656037ULL;
+  for(size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char) text[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static void
+dict_grow(Dict *dict) {
+  size_t capa = dict->capa == 0 ? 1024 : dict->capa * 2;
+  DictEntry *data = checked_realloc(NULL, sizeof(DictEntry) * capa);
+  memset(data, 0, sizeof(DictEntry) * capa);
+
+  for(size_t i = 0; i < dict->capa; i++) {
+    DictEntry *entry = &dict->data[i];
+    if(entry->text == NULL) continue;
+    size_t slot = text_hash(entry->text, entry->len) & (capa - 1);
+    while(data[slot].text != NULL) slot = (slot + 1) & (capa - 1);
+    data[slot] = *entry;
+  }
+
+  free(dict->data);
+  dict->data = data;
+  dict->capa = capa;
+}
+
+static TokenId
+dict_intern(Dict *dict, const char *text, size_t len) {
+  if(2 * ((size_t) dict->len + 1) > dict->capa) dict_grow(dict);
+
+  size_t slot = text_hash(text, len) & (dict->capa - 1);
+  for(;;) {
+    DictEntry *entry = &dict->data[slot];
+    if(entry->text == NULL) {
+      entry->text = checked_realloc(NULL, len + 1);
+      memcpy(entry->text, text, len);
+      entry->text[len] = '\0';
+      entry->len = len;
+      entry->id = dict->len++;
+      return entry->id;
+    }
+    if(entry->len == len && memcmp(entry->text, text, len) == 0) {
+      return entry->id;
+    }
+    slot = (slot + 1) & (dict->capa - 1);
+  }
+}
+
+static void
+dict_destroy(Dict *dict) {
+  for(size_t i = 0; i < dict->capa; i++) free(dict->data[i].text);
+  free(dict->data);
+}
+
+static char *
+read_file(const char *path, size_t *len) {
+  FILE *file = fopen(path, "rb");
+  if(file == NULL) {
+    perror(path);
+    exit(1);
+  }
+
+  size_t capa = 1 << 16;
+  char *data = checked_realloc(NULL, capa);
+  *len = 0;
+  size_t read;
+  while((read = fread(data + *len, 1, capa - *len, file)) > 0) {
+    *len += read;
+    if(*len == capa) {
+      capa *= 2;
+      data = checked_realloc(data, capa);
+    }
+  }
+  fclose(file);
+  return data;
+}
+
+static void
+token_file_load(TokenFile *file, const char *path, Dict *dict) {
+  size_t data_len;
+  char *data = read_file(path, &data_len);
+
+  size_t capa = 1024;
+  file->ids = checked_realloc(NULL, sizeof(TokenId) * capa);
+  file->len = 0;
+  size_t lines_capa = 256;
+  file->lines = checked_realloc(NULL, sizeof(TokenLine) * lines_capa);
+  file->lines_len = 0;
+  uint32_t line_start = 0;
+
+  size_t pos = 0;
+  while(pos < data_len) {
+    char *newline = memchr(data + pos, '\n', data_len - pos);
+    size_t end = newline == NULL ? data_len : (size_t) (newline - data);
+
+    if(end == pos) {
+      if(file->len > line_start) {
+        if(file->lines_len == lines_capa) {
+          lines_capa *= 2;
+          file->lines = checked_realloc(file->lines, sizeof(TokenLine) * lines_capa);
+        }
+        file->lines[file->lines_len].start = line_start;
+        file->lines[file->lines_len].len = (uint32_t) file->len - line_start;
+        file->lines_len++;
+        line_start = (uint32_t) file->len;
+      }
+    } else {
+      if(file->len == capa) {
+        capa *= 2;
+        file->ids = checked_realloc(file->ids, sizeof(TokenId) * capa);
+      }
+      file->ids[file->len++] = dict_intern(dict, data + pos, end - pos);
+    }
+    pos = end + 1;
+  }
+
+  if(file->len > line_start) {
+    if(file->lines_len == lines_capa) {
+      lines_capa *= 2;
+      file->lines = checked_realloc(file->lines, sizeof(TokenLine) * lines_capa);
+    }
+    file->lines[file->lines_len].start = line_start;
+    file->lines[file->lines_len].len = (uint32_t) file->len - line_start;
+    file->lines_len++;
+  }
+
+  free(data);
+}
+
+static double
+now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(void) {
+  fprintf(stderr,
+          "usage: diff_bench [options] OLD NEW\n"
+          "  --algorithm NAME  myers (default), patience or histogram\n"
+          "  --max-cost N      give up on exact diffs past N\n"
+          "  --lines           diff lines first, then the tokens of changed lines\n"
+          "  --distance        only compute the edit distance\n"
+          "  --repeat N        run N times and report the best time\n"
+          "  --stats           print the search counters of the last run\n");
+  exit(2);
+}
+
+int
+main(int argc, char **argv) {
+  DiffAlgorithm algorithm = DIFF_ALGORITHM_MYERS;
+  int64_t max_cost = INT64_MAX;
+  bool lines = false;
+  bool distance = false;
+  bool stats = false;
+  long repeat = 1;
+  const char *paths[2];
+  int paths_len = 0;
+
+  for(int i = 1; i < argc; i++) {
+    if(strcmp(argv[i], "--algorithm") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      if(strcmp(name, "myers") == 0) {
+        algorithm = DIFF_ALGORITHM_MYERS;
+      } else if(strcmp(name, "patience") == 0) {
+        algorithm = DIFF_ALGORITHM_PATIENCE;
+      } else if(strcmp(name, "histogram") == 0) {
+        algorithm = DIFF_ALGORITHM_HISTOGRAM;
+      } else {
+        usage();
+      }
+    } else if(strcmp(argv[i], "--max-cost") == 0 && i + 1 < argc) {
+      max_cost = strtoll(argv[++i], NULL, 10);
+      if(max_cost < 1) usage();
+    } else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = strtol(argv[++i], NULL, 10);
+      if(repeat < 1) usage();
+    } else if(strcmp(argv[i], "--lines") == 0) {
+      lines = true;
+    } else if(strcmp(argv[i], "--distance") == 0) {
+      distance = true;
+    } else if(strcmp(argv[i], "--stats") == 0) {
+      stats = true;
+    } else if(argv[i][0] == '-' || paths_len == 2) {
+      usage();
+    } else {
+      paths[paths_len++] = argv[i];
+    }
+  }
+  if(paths_len != 2) usage();
+
+  Dict dict = {0};
+  TokenFile file_old, file_new;
+  token_file_load(&file_old, paths[0], &dict);
+  token_file_load(&file_new, paths[1], &dict);
+
+  DiffWorkspace ws;
+  diff_workspace_init(&ws);
+
+  DiffEngine engine = {
+    .ids_old = file_old.ids,
+    .ids_new = file_new.ids,
+    .old_len = file_old.len,
+    .new_len = file_new.len,
+    .distinct_ids = dict.len,
+    .algorithm = algorithm,
+    .max_cost = max_cost,
+    .ws = &ws,
+  };
+  edit_script_init(&engine.edit_script, 128);
+  DiffStats diff_stats;
+
+  double best = -1;
+  int64_t result = 0;
+  for(long run = 0; run < repeat; run++) {
+    double start = now_seconds();
+
+    engine.edit_script.len = 0;
+    memset(&diff_stats, 0, sizeof(diff_stats));
+    engine.stats = stats ? &diff_stats : NULL;
+    if(!diff_engine_trim(&engine)) {
+      result = 0;
+    } else if(distance) {
+      result = diff_engine_distance(&engine, INT64_MAX);
+    } else if(lines) {
+      // the line walk takes lines of the trimmed tokens
+      uint32_t first_old = 0, first_new = 0;
+      while(first_old < file_old.lines_len &&
+            file_old.lines[first_old].start + file_old.lines[first_old].len <= (uint32_t) engine.prefix_len) first_old++;
+      while(first_new < file_new.lines_len &&
+            file_new.lines[first_new].start + file_new.lines[first_new].len <= (uint32_t) engine.prefix_len) first_new++;
+
+      uint32_t end_old = (uint32_t) (file_old.len - engine.suffix_len - engine.prefix_len);
+      uint32_t end_new = (uint32_t) (file_new.len - engine.suffix_len - engine.prefix_len);
+      TokenLine *lines_old = checked_realloc(NULL, sizeof(TokenLine) * (file_old.lines_len + 1));
+      TokenLine *lines_new = checked_realloc(NULL, sizeof(TokenLine) * (file_new.lines_len + 1));
+      uint32_t lines_old_len = 0, lines_new_len = 0;
+      for(uint32_t i = first_old; i < file_old.lines_len; i++) {
+        int64_t start_ = (int64_t) file_old.lines[i].start - engine.prefix_len;
+        int64_t end_ = MIN(start_ + file_old.lines[i].len, (int64_t) end_old);
+        start_ = MAX(start_, 0);
+        if(start_ >= end_) break;
+        lines_old[lines_old_len++] = (TokenLine) { .start = (uint32_t) start_, .len = (uint32_t) (end_ - start_) };
+      }
+      for(uint32_t i = first_new; i < file_new.lines_len; i++) {
+        int64_t start_ = (int64_t) file_new.lines[i].start - engine.prefix_len;
+        int64_t end_ = MIN(start_ + file_new.lines[i].len, (int64_t) end_new);
+        start_ = MAX(start_, 0);
+        if(start_ >= end_) break;
+        lines_new[lines_new_len++] = (TokenLine) { .start = (uint32_t) start_, .len = (uint32_t) (end_ - start_) };
+      }
+
+      diff_engine_walk_lines(&engine, lines_old, lines_old_len, lines_new, lines_new_len, end_old, end_new);
+      free(lines_old);
+      free(lines_new);
+    } else {
+      diff_engine_walk(&engine, 0, (uint32_t) (file_old.len - engine.suffix_len - engine.prefix_len),
+                                0, (uint32_t) (file_new.len - engine.suffix_len - engine.prefix_len));
+    }
+
+    double elapsed = now_seconds() - start;
+    if(best < 0 || elapsed < best) best = elapsed;
+  }
+
+  printf("tokens: %zu old, %zu new, %u distinct\n", file_old.len, file_new.len, dict.len);
+  if(distance) {
+    printf("distance: %lld\n", (long long) result);
+  } else {
+    uint64_t inserted = 0, deleted = 0;
+    for(uint32_t i = 0; i < engine.edit_script.len; i++) {
+      EditOp *op = &engine.edit_script.data[i];
+      if(op->type == CALLBACK_INS) inserted += op->len;
+      if(op->type == CALLBACK_DEL) deleted += op->len;
+    }
+    printf("edits: %u runs, %llu inserted, %llu deleted\n", engine.edit_script.len,
+           (unsigned long long) inserted, (unsigned long long) deleted);
+  }
+  if(stats) {
+    printf("stats: prefix %zd, suffix %zd, boxes %llu, max d %lld, max path %u, scratch %zu bytes\n",
+           engine.prefix_len, engine.suffix_len, (unsigned long long) diff_stats.boxes,
+           (long long) diff_stats.max_d, diff_stats.max_path_len,
+           ws.v_scratch_capa * sizeof(int64_t) + ws.path_array.capa * sizeof(Path) +
+           ws.path_frames.capa * sizeof(PathFrame) + engine.edit_script.capa * sizeof(EditOp));
+  }
+  printf("time: %.3fms (best of %ld)\n", best * 1000, repeat);
+
+  edit_script_destroy(&engine.edit_script);
+  diff_workspace_destroy(&ws);
+  free(file_old.ids);
+  free(file_old.lines);
+  free(file_new.ids);
+  free(file_new.lines);
+  dict_destroy(&dict);
+  return 0;
+}
@@ -1,35 +1,34 @@
 #include "ruby.h"
+#include "ruby/thread.h"
 #include "ruby/internal/special_consts.h"
 #include "ruby/internal/value_type.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
-/*
-Implementation based on this blog post:
-https://blog.jcoglan.com/2017/03/22/myers-diff-in-linear-space-theory/
-*/
+#include "engine.h"
 
 VALUE rb_mTSDiff;
 VALUE rb_cChangeSet;
+VALUE rb_cTokenizedTree;
 VALUE rb_eTsDiffError;
 
 static ID id_eql;
 static ID id_add;
 static ID id_del;
 static ID id_sub;
+static ID id_myers;
+static ID id_patience;
+static ID id_histogram;
+static ID id_last_stats;
 
-#ifndef MAX
-#define MAX(a,b) (((a)<(b))?(b):(a))
-#endif
 
-#ifndef MIN
-#define MIN(a,b) (((a)>(b))?(b):(a))
-#endif
-
-
-#undef NDEBUG
 #include <assert.h>
 
 typedef struct {
@@ -54,35 +53,91 @@ typedef struct TokenArray {
   size_t capa;
 } TokenArray;
 
-typedef struct TmpTokenArray {
-  Token *data;
-  size_t len;
-  size_t capa;
+// The tokens [start, start + len) of one side gathered for the next change set
+typedef struct TmpTokenRange {
+  uint32_t start;
+  uint32_t len;
+  // one past the last token of the side walked so far, kept across resets
+  uint32_t end;
   bool non_eq;
-} TmpTokenArray;
+} TmpTokenRange;
 
 typedef struct {} Tree;
 
+// A node of the tree_sitter gem, the same pair a Token starts with
+typedef struct {
+  TSNode ts_node;
+  VALUE rb_tree;
+} Node;
+
 TokenArray rb_node_tokenize_(VALUE self, VALUE rb_ignore_whitespace, VALUE rb_ignore_comments);
 const char *rb_node_input_(VALUE self, uint32_t *start, uint32_t *len);
 VALUE rb_new_token_from_ptr(Token *orig_token);
 void tree_sitter_token_mark(Token *token);
 Tree *rb_tree_unwrap(VALUE self);
-// typedef struct {
-//   uint32_t capa;
-//   uint32_t len;
-//   st_data_t *entries;
-// } IndexValue;
-
-// typedef struct {
-//   uint32_t start_byte;
-//   uint32_t end_byte;
-//   const char *input;
-// } IndexKey;
-
+Node *rb_node_unwrap(VALUE self);
+
+TSNode ts_node_parent(TSNode self);
+bool ts_node_is_null(TSNode self);
+bool ts_node_is_named(TSNode self);
+uint32_t ts_node_start_byte(TSNode self);
+uint32_t ts_node_end_byte(TSNode self);
+uint16_t ts_node_symbol(TSNode self);
+const char *ts_node_type(TSNode self);
+TSNode ts_node_prev_sibling(TSNode self);
+TSNode ts_node_prev_named_sibling(TSNode self);
+
+/* Only ever handled through pointers, apart from being returned by
+   ts_tree_cursor_new, so the larger context of newer tree-sitter
+   versions is declared to leave room for either */
+typedef struct {
+  const void *tree;
+  const void *id;
+  uint32_t context[3];
+} TSTreeCursor;
+
+TSTreeCursor ts_tree_cursor_new(TSNode node);
+void ts_tree_cursor_delete(TSTreeCursor *self);
+TSNode ts_tree_cursor_current_node(const TSTreeCursor *self);
+bool ts_tree_cursor_goto_first_child(TSTreeCursor *self);
+bool ts_tree_cursor_goto_next_sibling(TSTreeCursor *self);
+bool ts_tree_cursor_goto_parent(TSTreeCursor *self);
+
+/* The token arrays of both sides of a diff, handed over by the diff context
+   and shared by all of its change sets. The trees the tokens reference are
+   collected once, so that marking does not depend on the number of tokens */
 typedef struct {
   VALUE rb_old;
   VALUE rb_new;
+  TokenArray tokens_old;
+  TokenArray tokens_new;
+  // the TokenizedTree a side's tokens are borrowed from, nil if the arena owns them
+  VALUE rb_tokenized_old;
+  VALUE rb_tokenized_new;
+  VALUE *rb_trees;
+  uint32_t rb_trees_len;
+} TokenArena;
+
+/* The tokens of a node with their hashes, computed once so that the node
+   can be diffed against any number of others. Frozen, the diffs only read
+   the tokens, so they can be shared by the threads of diff_many */
+typedef struct {
+  VALUE rb_node;
+  TokenArray tokens;
+  st_index_t *hashes;
+  const char *input;
+  uint32_t input_start;
+  uint32_t input_len;
+  bool ignore_whitespace;
+  bool ignore_comments;
+  VALUE *rb_trees;
+  uint32_t rb_trees_len;
+} TokenizedTree;
+
+/* Slices of the arena, which is kept alive by every change set pointing into it.
+   An empty side still points at the token it was found before */
+typedef struct {
+  VALUE rb_arena;
   Token *old_tokens;
   Token *new_tokens;
   uint32_t old_len;
@@ -97,166 +152,190 @@ typedef enum {
   CHANGE_TYPE_SUB,
 } ChangeType;
 
-// typedef struct {
-//   uint32_t len;
-// } Match;
-
-// typedef struct {
-//   Match *data;
-//   uint32_t min_index;
-//   uint32_t max_index;
-// } MatchMap;
-
-// typedef struct {
-//   uint32_t sub_start_old;
-//   uint32_t sub_start_new;
-//   uint32_t sub_len;
-// } BetterMatch;
-
-// #define BETTER_MATCH_ARRAY_INLINE_CAPA 6
-
-// typedef struct {
-//   BetterMatch *data;
-//   BetterMatch inline_data[BETTER_MATCH_ARRAY_INLINE_CAPA];
-//   uint32_t len;
-//   uint32_t capa;
-//   uint32_t max;
-// } BetterMatchArray;
-
-typedef struct Path {
-  int64_t x;
-  int64_t y;
-  uint32_t next;
-} Path;
-
-typedef uint32_t PathIdx;
+typedef struct {
+  Token *token;
+  const char *input;
+  st_index_t hash;
+} TokenDictEntry;
 
+// Open-addressing table mapping token contents to dense ids.
+// buckets hold id + 1, 0 marks an empty bucket
 typedef struct {
-  Path *data;
+  TokenDictEntry *entries;
+  uint32_t *buckets;
   uint32_t len;
   uint32_t capa;
-} PathArray;
-
-// typedef struct {
-//   uint32_t *data;
-//   uint32_t rows;
-//   uint32_t cols;
-// } Matrix;
-
-typedef enum {
-  CALLBACK_START,
-  CALLBACK_FINISH,
-  CALLBACK_EQ,
-  CALLBACK_INS,
-  CALLBACK_DEL,
-} CallbackType;
+  uint32_t mask;
+} TokenDict;
 
 struct DiffContext;
 
 typedef void (*Callback)(struct DiffContext *ctx, CallbackType type, Token *token_old, Token *token_new);
 
 typedef struct DiffContext {
+  DiffEngine engine;
   TokenArray tokens_old;
   TokenArray tokens_new;
   Token *tokens_old_;
   Token *tokens_new_;
-  // MatchMap match_map;
-  // MatchMap next_match_map;
-  PathArray path_array;
-  // IndexValue index_list;
-  // IndexKey *table_entries_old;
-  // st_table *old_index_map;
   const char *input_old;
   const char *input_new;
   VALUE rb_old;
   VALUE rb_new;
+  VALUE rb_tokenized_old;
+  VALUE rb_tokenized_new;
+  const st_index_t *hashes_old;
+  const st_index_t *hashes_new;
   bool output_eq;
   bool output_replace;
   bool split_lines;
+  bool lazy;
   Callback cb;
-  TmpTokenArray tmp_tokens_old;
-  TmpTokenArray tmp_tokens_new;
+  TmpTokenRange tmp_tokens_old;
+  TmpTokenRange tmp_tokens_new;
+  VALUE rb_arena;
   VALUE rb_out_ary;
+  VALUE rb_out_str;
+  int64_t max_distance;
+  int64_t distance;
+  uint32_t anchor_min_len;
+  Box *edit_windows;
+  uint32_t edit_windows_len;
+  uint32_t input_old_start;
+  uint32_t input_new_start;
+  uint32_t input_old_end;
+  uint32_t input_new_end;
+  bool finished;
+  // kept only with stats: true, see diff_context_store_stats
+  DiffStats stats;
+  uint64_t tokenize_ns;
+  uint64_t search_ns;
+  uint64_t output_ns;
 } DiffContext;
 
-static void change_set_free(void *ptr)
+static void token_arena_free(void *ptr)
 {
-  ChangeSet *change_set = (ChangeSet *) ptr;
-  xfree(change_set->old_tokens);
-  xfree(change_set->new_tokens);
+  TokenArena *arena = (TokenArena *) ptr;
+  if(NIL_P(arena->rb_tokenized_old)) xfree(arena->tokens_old.data);
+  if(NIL_P(arena->rb_tokenized_new)) xfree(arena->tokens_new.data);
+  xfree(arena->rb_trees);
   xfree(ptr);
 }
 
-static void change_set_mark(void *ptr) {
-  ChangeSet *change_set = (ChangeSet *) ptr;
-  rb_gc_mark(change_set->rb_old);
-  rb_gc_mark(change_set->rb_new);
+static void token_arena_mark(void *ptr) {
+  TokenArena *arena = (TokenArena *) ptr;
+  rb_gc_mark(arena->rb_old);
+  rb_gc_mark(arena->rb_new);
+  rb_gc_mark(arena->rb_tokenized_old);
+  rb_gc_mark(arena->rb_tokenized_new);
 
-  for(size_t i = 0; i < change_set->old_len; i++) {
-    tree_sitter_token_mark(&change_set->old_tokens[i]);
+  for(uint32_t i = 0; i < arena->rb_trees_len; i++) {
+    rb_gc_mark(arena->rb_trees[i]);
   }
+}
+
+static size_t token_arena_memsize(const void *ptr) {
+  const TokenArena *arena = (const TokenArena *) ptr;
+  return sizeof(TokenArena) +
+         (NIL_P(arena->rb_tokenized_old) ? arena->tokens_old.capa * sizeof(Token) : 0) +
+         (NIL_P(arena->rb_tokenized_new) ? arena->tokens_new.capa * sizeof(Token) : 0) +
+         arena->rb_trees_len * sizeof(VALUE);
+}
+
+static const rb_data_type_t token_arena_type = {
+    .wrap_struct_name = "TokenArena",
+    .function = {
+        .dmark = token_arena_mark,
+        .dfree = token_arena_free,
+        .dsize = token_arena_memsize,
+    },
+    .data = NULL,
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
+};
+
+static void tokenized_tree_free(void *ptr)
+{
+  TokenizedTree *tokenized = (TokenizedTree *) ptr;
+  xfree(tokenized->tokens.data);
+  xfree(tokenized->hashes);
+  xfree(tokenized->rb_trees);
+  xfree(ptr);
+}
 
-  for(size_t i = 0; i < change_set->new_len; i++) {
-    tree_sitter_token_mark(&change_set->new_tokens[i]);
+static void tokenized_tree_mark(void *ptr) {
+  TokenizedTree *tokenized = (TokenizedTree *) ptr;
+  rb_gc_mark(tokenized->rb_node);
+
+  for(uint32_t i = 0; i < tokenized->rb_trees_len; i++) {
+    rb_gc_mark(tokenized->rb_trees[i]);
   }
 }
 
+static size_t tokenized_tree_memsize(const void *ptr) {
+  const TokenizedTree *tokenized = (const TokenizedTree *) ptr;
+  return sizeof(TokenizedTree) +
+         tokenized->tokens.capa * sizeof(Token) +
+         tokenized->tokens.len * sizeof(st_index_t) +
+         tokenized->rb_trees_len * sizeof(VALUE);
+}
+
+static const rb_data_type_t tokenized_tree_type = {
+    .wrap_struct_name = "TokenizedTree",
+    .function = {
+        .dmark = tokenized_tree_mark,
+        .dfree = tokenized_tree_free,
+        .dsize = tokenized_tree_memsize,
+    },
+    .data = NULL,
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
+};
+
+static void change_set_free(void *ptr)
+{
+  xfree(ptr);
+}
+
+static void change_set_mark(void *ptr) {
+  ChangeSet *change_set = (ChangeSet *) ptr;
+  rb_gc_mark(change_set->rb_arena);
+}
+
+// The tokens belong to the arena, which reports them itself
+static size_t change_set_memsize(const void *ptr) {
+  (void) ptr;
+  return sizeof(ChangeSet);
+}
+
 static const rb_data_type_t change_set_type = {
     .wrap_struct_name = "ChangeSet",
     .function = {
         .dmark = change_set_mark,
         .dfree = change_set_free,
-        .dsize = NULL,
+        .dsize = change_set_memsize,
     },
     .data = NULL,
-    .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
 };
 
 static void
-add_tmp_token(TmpTokenArray *tokens, Token token, CallbackType type) {
-  if(tokens->len >= tokens->capa) {
-    size_t new_capa = 2 * tokens->capa;
-    RB_REALLOC_N(tokens->data, Token, new_capa);
-    tokens->capa = new_capa;
+add_tmp_token(TmpTokenRange *tokens, uint32_t index, CallbackType type) {
+  if(tokens->len == 0) {
+    tokens->start = index;
   }
 
-  tokens->data[tokens->len] = token;
+  // the edit script walks both sides in order, so change sets are contiguous
+  assert(tokens->start + tokens->len == index);
   tokens->len++;
   tokens->non_eq = (type != CALLBACK_EQ);
 }
 
 static void
-tmp_token_array_init(TmpTokenArray *token_array, uint32_t capa) {
-  token_array->data = RB_ZALLOC_N(Token, capa);
-  token_array->capa = capa;
-  token_array->len = 0;
-  token_array->non_eq = false;
-}
-
-static void
-tmp_token_array_destroy(TmpTokenArray *token_array) {
-  xfree(token_array->data);
+tmp_token_range_reset(TmpTokenRange *token_range) {
+  token_range->start = 0;
+  token_range->len = 0;
+  token_range->non_eq = false;
 }
 
-static void
-tmp_token_array_reset(TmpTokenArray *token_array) {
-  token_array->len = 0;
-  token_array->non_eq = false;
-}
-
-// static st_index_t
-// index_key_hash(st_data_t arg) {
-//   IndexKey *table_entry = (IndexKey *) arg;
-
-//   uint32_t start_byte = table_entry->start_byte;
-//   uint32_t end_byte = table_entry->end_byte;
-//   const char *str = table_entry->input + start_byte;
-//   size_t len = end_byte - start_byte;
-
-//   //return st_hash(str, len, FNV1_32A_INIT);
-//   return rb_memhash(str, len); // ^ len;
-// }
-
 static bool
 token_eql(Token *x, const char *input_x, Token *y, const char *input_y) {
   uint32_t start_byte_x = x->start_byte;
@@ -277,1119 +356,684 @@ token_eql(Token *x, const char *input_x, Token *y, const char *input_y) {
   }
 }
 
-// static int
-// index_key_cmp(st_data_t x, st_data_t y) {
-//   IndexKey *table_entry_x = (IndexKey *) x;
-//   IndexKey *table_entry_y = (IndexKey *) y;
-
-//   uint32_t start_byte_x = table_entry_x->start_byte;
-//   uint32_t end_byte_x = table_entry_x->end_byte;
-
-//   uint32_t start_byte_y = table_entry_y->start_byte;
-//   uint32_t end_byte_y = table_entry_y->end_byte;
-
-//   uint32_t len_x = end_byte_x - start_byte_x;
-//   uint32_t len_y = end_byte_y - start_byte_y;
-
-//   if(len_x != len_y) {
-//     return 1;
-//   } else {
-//     const char *str_x = table_entry_x->input + start_byte_x;
-//     const char *str_y = table_entry_y->input + start_byte_y;
-//     return memcmp(str_x, str_y, len_x);
-//   }
-// }
-
-// static const struct st_hash_type type_index_key_hash = {
-//     index_key_cmp,
-//     index_key_hash,
-// };
-
-// static IndexListEntry *
-// index_list_request_entry(IndexValue *index_list) {
-//   if(!(index_list->len < index_list->capa)) {
-//     uint32_t new_capa = 2 * index_list->capa;
-//     RB_REALLOC_N(index_list->entries, IndexListEntry, new_capa);
-//     index_list->capa = new_capa;
-//   }
-//   IndexListEntry *entry = &index_list->entries[index_list->len];
-//   index_list->len++;
-//   return entry;
-// }
-
-
-// static uint32_t
-// index_list_append(IndexValue *index_list, st_data_t pair) {
-//   if(!(index_list->len < index_list->capa)) {
-//     uint32_t new_capa = 2 * index_list->capa;
-//     RB_REALLOC_N(index_list->entries, st_data_t, new_capa);
-//     index_list->capa = new_capa;
-//   }
-//   uint32_t index = index_list->len;
-//   index_list->entries[index] = pair;
-//   index_list->len++;
-//   return index;
-// }
-
-//   if(entry == NULL) {
-//       ret_entry = index_list_request_entry(index_list);
-//       ret_entry->next = UINT32_MAX;
-//       ret_entry->len = 1;
-//       ret_entry->data[0] = value;
-//   } else {
-//     if(!(entry->len < INDEX_LIST_ENTRY_CAPA)) {
-//       ret_entry = index_list_request_entry(index_list);
-//       size_t entry_index = entry - index_list->entries;
-//       ret_entry->next = entry_index;
-//       ret_entry->len = 1;
-//       ret_entry->data[0] = value;
-//     } else {
-//       entry->data[entry->len] = value;
-//       entry->len++;
-//       ret_entry = entry;
-//     }
-//   }
-
-//   assert(ret_entry->next == UINT32_MAX || ret_entry->next < index_list->len);
-//   return ret_entry;
-// }
-
-// typedef struct {
-//   IndexValue *index_list;
-//   uint32_t value;
-// } UpdateArg;
-
-// _Static_assert(sizeof(st_data_t) >= 2 * sizeof(uint32_t));
-
-// #define MAKE_PAIR64(f, s) ((((st_data_t)(s)) << 32) | ((st_data_t)(f)))
-// #define PAIR64_FIRST(p) ((p) & 0xFFFFFFFF)
-// #define PAIR64_SECOND(p) ((p) >> 32)
-
-// static int
-// update_callback(st_data_t *key, st_data_t *value, st_data_t arg, int existing) {
-//   UpdateArg *update_arg = (UpdateArg *) arg;
-//   IndexValue *index_list = update_arg->index_list;
-//   uint32_t insert_value = update_arg->value;
-
-//   if(!existing) {
-//     *value = MAKE_PAIR64(insert_value, UINT32_MAX);
-//   } else {
-//     uint32_t inserted_index = index_list_append(index_list, *value);
-//     *value = MAKE_PAIR64(insert_value, inserted_index);
-//   }
-
-//   return ST_CONTINUE;
-// }
-
-// static inline uint32_t
-// matrix_get(Matrix *matrix, uint32_t row, uint32_t col) {
-//   return matrix->data[row * matrix->cols + col];
-// }
-
-// static void uint32_t
-// matrix_set(Matrix *matrix, uint32_t row, uint32_t col, uint32_t val) {
-//   matrix->data[row * matrix->cols + col] = val;
-// }
-
-// static void
-// matrix_init(Matrix *matrix, uint32_t rows, uint32_t cols) {
-//   matrix->rows = rows;
-//   matrix->cols = cols;
-//   matrix->data = RB_ALLOC_N(uint32_t, rows * cols);
-// }
-
-// static void
-// matrix_destroy(Matrix *matrix) {
-//   xfree(matrix->data);
-// }
-
-// static void
-// match_map_init(MatchMap *map, uint32_t len) {
-//   map->data = RB_ZALLOC_N(Match, len);
-//   map->min_index = len;
-//   map->max_index = 0;
-// }
-
-// static void
-// match_map_destroy(MatchMap *map) {
-//   xfree(map->data);
-// }
-
-// static void
-// match_map_insert(MatchMap *map, uint32_t index, uint32_t len) {
-//   Match match = {
-//     .len = len
-//   };
-//   map->data[index] = match;
-//   map->max_index = MAX(map->max_index, index);
-//   map->min_index = MIN(map->min_index, index);
-// }
-
-// static void
-// match_map_reset(MatchMap *map) {
-//   if(map->min_index <= map->max_index) {
-//      memset(map->data + map->min_index, 0, (map->max_index - map->min_index + 1) * sizeof(Match));
-//   }
-//   // memset(map->data, 0, map->max_index * sizeof(uint32_t));
-// }
-
-// static void
-// better_match_array_init(BetterMatchArray *better_match_array) {
-//     better_match_array->data = &better_match_array->inline_data[0];
-//     better_match_array->capa = BETTER_MATCH_ARRAY_INLINE_CAPA;
-//     better_match_array->len = 0;
-//     better_match_array->max = 0;
-
-// }
-
-// static uint32_t
-// better_match_array_insert(BetterMatchArray *better_match_array, BetterMatch match) {
-
-//   if(better_match_array->max < match.sub_len) {
-//     better_match_array->data[0] = match;
-//     better_match_array->len = 1;
-//     better_match_array->max = match.sub_len;
-//     return 0;
-//   } else {
-//     if(!(better_match_array->len < better_match_array->capa)) {
-//       uint32_t new_capa = 2 * better_match_array->capa;
-//       if(better_match_array->data == &better_match_array->inline_data[0]) {
-//         better_match_array->data = RB_ALLOC_N(BetterMatch, new_capa);
-//         memcpy(better_match_array->data, &better_match_array->inline_data[0], sizeof(better_match_array->inline_data));
-//       } else {
-//         RB_REALLOC_N(better_match_array->data, BetterMatch, new_capa);
-//       }
-//       better_match_array->capa = new_capa;
-//     }
-
-//     uint32_t index = better_match_array->len;
-//     better_match_array->data[index] = match;
-//     better_match_array->len++;
-
-//     return index;
-//   }
-// }
-
-// static uint32_t
-// better_match_array_reset(BetterMatchArray *better_match_array) {
-//   memset(better_match_array->data, 0, sizeof(BetterMatch) * better_match_array->len);
-// }
-
-// static void
-// better_match_array_destroy(BetterMatchArray *better_match_array) {
-//   if(better_match_array->data != &better_match_array->inline_data[0]) {
-//     xfree(better_match_array->data);
-//   }
-// }
+static void
+token_dict_init(TokenDict *dict, size_t capa) {
+  size_t buckets_len = 16;
+  while(buckets_len < 2 * capa) buckets_len *= 2;
+
+  dict->entries = ENGINE_ALLOC_N(TokenDictEntry, capa);
+  dict->buckets = ENGINE_ZALLOC_N(uint32_t, buckets_len);
+  dict->len = 0;
+  dict->capa = (uint32_t) capa;
+  dict->mask = (uint32_t) (buckets_len - 1);
+}
 
+// Makes room for capa entries, rehashing from the stored hashes when the buckets fill up
 static void
-path_array_init(PathArray *path_array, uint32_t capa) {
-  path_array->data = RB_ZALLOC_N(Path, capa);
-  path_array->capa = capa;
-  // 0 is the empty list
-  path_array->len = 1;
+token_dict_reserve(TokenDict *dict, size_t capa) {
+  if(capa <= dict->capa) return;
+
+  capa = MAX(capa, 2 * (size_t) dict->capa);
+  ENGINE_REALLOC_N(dict->entries, TokenDictEntry, capa);
+  dict->capa = (uint32_t) capa;
+
+  size_t buckets_len = (size_t) dict->mask + 1;
+  if(buckets_len >= 2 * capa) return;
+  while(buckets_len < 2 * capa) buckets_len *= 2;
+
+  ENGINE_FREE(dict->buckets);
+  dict->buckets = ENGINE_ZALLOC_N(uint32_t, buckets_len);
+  dict->mask = (uint32_t) (buckets_len - 1);
+
+  for(uint32_t id = 0; id < dict->len; id++) {
+    uint32_t bucket_idx = (uint32_t) dict->entries[id].hash & dict->mask;
+    while(dict->buckets[bucket_idx] != 0) bucket_idx = (bucket_idx + 1) & dict->mask;
+    dict->buckets[bucket_idx] = id + 1;
+  }
 }
 
 static void
-path_array_destroy(PathArray *path_array) {
-  xfree(path_array->data);
+token_dict_destroy(TokenDict *dict) {
+  ENGINE_FREE(dict->entries);
+  ENGINE_FREE(dict->buckets);
 }
 
-static uint32_t
-path_array_push(PathArray *path_array, Path **path) {
-  if(!(path_array->len < path_array->capa)) {
-    uint32_t new_capa = 2 * path_array->capa;
-    RB_REALLOC_N(path_array->data, Path, new_capa);
-    path_array->capa = new_capa;
+static st_index_t
+token_hash(Token *token, const char *input) {
+  return rb_memhash(input + token->start_byte, token->end_byte - token->start_byte);
+}
+
+static TokenId
+token_dict_intern(TokenDict *dict, Token *token, const char *input, st_index_t hash) {
+  uint32_t bucket_idx = (uint32_t) hash & dict->mask;
+
+  while(true) {
+    uint32_t bucket = dict->buckets[bucket_idx];
+    if(bucket == 0) {
+      TokenId id = dict->len;
+      dict->entries[id] = (TokenDictEntry) {
+        .token = token,
+        .input = input,
+        .hash = hash,
+      };
+      dict->buckets[bucket_idx] = id + 1;
+      dict->len++;
+      return id;
+    }
+
+    TokenDictEntry *entry = &dict->entries[bucket - 1];
+    if(entry->hash == hash && token_eql(entry->token, entry->input, token, input)) {
+      return bucket - 1;
+    }
+    bucket_idx = (bucket_idx + 1) & dict->mask;
+  }
+}
+
+// Interns the tokens [start, end) of the old side, or of the new side if new_side
+static void
+intern_token_range(DiffContext *ctx, TokenDict *dict, bool new_side, size_t start, size_t end) {
+  Token *tokens = new_side ? ctx->tokens_new.data : ctx->tokens_old.data;
+  const char *input = new_side ? ctx->input_new : ctx->input_old;
+  const st_index_t *hashes = new_side ? ctx->hashes_new : ctx->hashes_old;
+  TokenId *ids = new_side ? ctx->engine.ids_new : ctx->engine.ids_old;
+
+  token_dict_reserve(dict, dict->len + (end - start));
+
+  // a TokenizedTree side comes with its hashes
+  for(size_t i = start; i < end; i++) {
+    Token *token = &tokens[i];
+    assert(token->end_byte <= (new_side ? ctx->input_new_end : ctx->input_old_end));
+    st_index_t hash = hashes != NULL ? hashes[i] : token_hash(token, input);
+    ids[i] = token_dict_intern(dict, token, input, hash);
   }
-  uint32_t index = path_array->len;
-  path_array->data[index] = (Path) {0, };
-  *path = &path_array->data[index];
-  path_array->len++;
-  return index;
 }
 
-static inline Path *
-path_array_get(PathArray *path_array, uint32_t idx) {
-  return &path_array->data[idx];
+/* Maps the tokens of both sides to dense ids, so that the search only
+   has to compare integers instead of token contents */
+static void
+intern_tokens(DiffContext *ctx) {
+  TokenDict dict;
+
+  token_dict_init(&dict, ctx->tokens_old.len + ctx->tokens_new.len);
+  intern_token_range(ctx, &dict, false, 0, ctx->tokens_old.len);
+  intern_token_range(ctx, &dict, true, 0, ctx->tokens_new.len);
+  ctx->engine.distinct_ids = dict.len;
+
+  token_dict_destroy(&dict);
 }
 
 static VALUE
-rb_change_set_new_full(ChangeType change_type, VALUE rb_old, VALUE rb_new,
+rb_change_set_new_full(ChangeType change_type, VALUE rb_arena,
                        Token *old_tokens, size_t old_start, size_t old_len,
                        Token *new_tokens, size_t new_start, size_t new_len)
 {
-  ChangeSet *change_set = RB_ALLOC(ChangeSet);
+  ChangeSet *change_set;
+  VALUE rb_change_set = TypedData_Make_Struct(rb_cChangeSet, ChangeSet, &change_set_type, change_set);
   change_set->change_type = change_type;
-  change_set->rb_old = rb_old;
-  change_set->rb_new = rb_new;
+  RB_OBJ_WRITE(rb_change_set, &change_set->rb_arena, rb_arena);
   change_set->old_len = old_len;
   change_set->new_len = new_len;
-  change_set->old_tokens = NULL;
-  change_set->new_tokens = NULL;
+  change_set->old_tokens = old_tokens != NULL ? old_tokens + old_start : NULL;
+  change_set->new_tokens = new_tokens != NULL ? new_tokens + new_start : NULL;
 
-  // assert(old_len == 0 || new_len == 0 || old_len == new_len);
+  return rb_change_set;
+}
+
+/* Adds the distinct trees referenced by tokens to the trees marked by
+   rb_owner. All tokens of a side normally come from the same tree */
+static void
+token_trees_collect(VALUE rb_owner, TokenArray *tokens, VALUE **rb_trees, uint32_t *rb_trees_len, uint32_t *rb_trees_capa) {
+  VALUE rb_last_tree = Qundef;
+  for(size_t i = 0; i < tokens->len; i++) {
+    VALUE rb_tree = tokens->data[i].rb_tree;
+    if(rb_tree == rb_last_tree) continue;
+    rb_last_tree = rb_tree;
+
+    bool seen = false;
+    for(uint32_t j = 0; j < *rb_trees_len && !seen; j++) {
+      seen = (*rb_trees)[j] == rb_tree;
+    }
+    if(seen) continue;
 
-  if(old_len > 0) {
-    change_set->old_tokens = RB_ALLOC_N(Token, old_len);
-    memcpy(change_set->old_tokens, old_tokens + old_start, old_len * sizeof(Token));
+    if(*rb_trees_len == *rb_trees_capa) {
+      *rb_trees_capa *= 2;
+      RB_REALLOC_N(*rb_trees, VALUE, *rb_trees_capa);
+    }
+    RB_OBJ_WRITE(rb_owner, &(*rb_trees)[*rb_trees_len], rb_tree);
+    (*rb_trees_len)++;
   }
+}
 
-  if(new_len > 0) {
-    change_set->new_tokens = RB_ALLOC_N(Token, new_len);
-    memcpy(change_set->new_tokens, new_tokens + new_start, new_len * sizeof(Token));
+/* Hands the token arrays of the context over to a new arena, the
+   context must not free them anymore */
+static VALUE
+token_arena_new(DiffContext *ctx) {
+  TokenArena *arena;
+  VALUE rb_arena = TypedData_Make_Struct(0, TokenArena, &token_arena_type, arena);
+  RB_OBJ_WRITE(rb_arena, &arena->rb_old, ctx->rb_old);
+  RB_OBJ_WRITE(rb_arena, &arena->rb_new, ctx->rb_new);
+  arena->tokens_old = ctx->tokens_old;
+  arena->tokens_new = ctx->tokens_new;
+  RB_OBJ_WRITE(rb_arena, &arena->rb_tokenized_old, ctx->rb_tokenized_old);
+  RB_OBJ_WRITE(rb_arena, &arena->rb_tokenized_new, ctx->rb_tokenized_new);
+  ctx->rb_arena = rb_arena;
+
+  // borrowed tokens are kept alive by their TokenizedTree
+  uint32_t rb_trees_capa = 2;
+  arena->rb_trees = RB_ALLOC_N(VALUE, rb_trees_capa);
+  if(NIL_P(arena->rb_tokenized_old)) {
+    token_trees_collect(rb_arena, &arena->tokens_old, &arena->rb_trees, &arena->rb_trees_len, &rb_trees_capa);
+  }
+  if(NIL_P(arena->rb_tokenized_new)) {
+    token_trees_collect(rb_arena, &arena->tokens_new, &arena->rb_trees, &arena->rb_trees_len, &rb_trees_capa);
   }
-  // fprintf(stderr, "TOKEN SET %d/%d  %d/%d\n", old_start, old_len, new_start, new_len);
 
-  
-  return TypedData_Wrap_Struct(rb_cChangeSet, &change_set_type, change_set);
+  return rb_arena;
+}
+
+/* Byte range of the tokens [start, start + len) of a side. An empty
+   side is the point after the token preceding position start, or the
+   start of the input, lower, before the first token */
+static void
+token_byte_range(TokenArray *tokens, uint32_t start, uint32_t len, uint32_t lower,
+                 uint32_t *start_byte, uint32_t *end_byte) {
+  if(len > 0) {
+    *start_byte = tokens->data[start].start_byte;
+    *end_byte = tokens->data[start + len - 1].end_byte;
+  } else {
+    *start_byte = *end_byte = start > 0 ? tokens->data[start - 1].end_byte : lower;
+  }
 }
 
-// static VALUE
-// rb_change_set_new(ChangeType change_type, VALUE rb_input,
-//                   TokenArray *tokens, size_t start, size_t len)
-// {
-//   switch(change_type) {
-//     case CHANGE_TYPE_DEL:
-//       return rb_change_set_new_full(change_type, rb_input, Qnil,
-//                         tokens, start, len,
-//                         NULL, 0, 0);
-//     case CHANGE_TYPE_ADD:
-//       return rb_change_set_new_full(change_type, Qnil, rb_input,
-//                         NULL, 0, 0,
-//                         tokens, start, len);
-//     default:
-//       return Qnil;                        
-//   }
-// }
+/* Appends a change set to the output, or just its byte ranges as a
+   record of five native-endian uint32 (type, old_start, old_end,
+   new_start, new_end) when ctx->rb_out_str is set */
+static void
+push_change_set(DiffContext *ctx, ChangeType change_type,
+                uint32_t old_start, uint32_t old_len, uint32_t new_start, uint32_t new_len) {
+  if(NIL_P(ctx->rb_out_str)) {
+    rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(change_type, ctx->rb_arena,
+                                                        ctx->tokens_old.data, old_start, old_len,
+                                                        ctx->tokens_new.data, new_start, new_len));
+    return;
+  }
+
+  uint32_t record[5];
+  record[0] = (uint32_t) change_type;
+  token_byte_range(&ctx->tokens_old, old_start, old_len, ctx->input_old_start, &record[1], &record[2]);
+  token_byte_range(&ctx->tokens_new, new_start, new_len, ctx->input_new_start, &record[3], &record[4]);
+  rb_str_buf_cat(ctx->rb_out_str, (const char *) record, sizeof(record));
+}
 
 static void
 output_change_set(DiffContext *ctx) {
-  if(ctx->tmp_tokens_new.len == 0) {
-    if(ctx->tmp_tokens_old.len == 0) return;
-    rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_DEL, ctx->rb_old, Qnil,
-                                                        ctx->tmp_tokens_old.data, 0, ctx->tmp_tokens_old.len,
-                                                        NULL, 0, 0));
-
-  } else if(ctx->tmp_tokens_old.len == 0) {
-    if(ctx->tmp_tokens_new.len == 0) return;
-    rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_ADD, Qnil, ctx->rb_new,
-                                                        NULL, 0, 0,
-                                                        ctx->tmp_tokens_new.data, 0, ctx->tmp_tokens_new.len));
+  TmpTokenRange *old_range = &ctx->tmp_tokens_old;
+  TmpTokenRange *new_range = &ctx->tmp_tokens_new;
+
+  if(new_range->len == 0) {
+    if(old_range->len == 0) return;
+    push_change_set(ctx, CHANGE_TYPE_DEL, old_range->start, old_range->len, new_range->end, 0);
+  } else if(old_range->len == 0) {
+    if(new_range->len == 0) return;
+    push_change_set(ctx, CHANGE_TYPE_ADD, old_range->end, 0, new_range->start, new_range->len);
   } else {
-    if(!ctx->tmp_tokens_old.non_eq && !ctx->tmp_tokens_new.non_eq) {
-      assert(ctx->tmp_tokens_old.len == ctx->tmp_tokens_new.len);
-      rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_EQL, ctx->rb_old, ctx->rb_new,
-                                                          ctx->tmp_tokens_old.data, 0, ctx->tmp_tokens_old.len,
-                                                          ctx->tmp_tokens_new.data, 0, ctx->tmp_tokens_new.len));
+    if(!old_range->non_eq && !new_range->non_eq) {
+      assert(old_range->len == new_range->len);
+      push_change_set(ctx, CHANGE_TYPE_EQL, old_range->start, old_range->len, new_range->start, new_range->len);
     } else {
       if(ctx->output_replace) {
-        rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_SUB, ctx->rb_old, ctx->rb_new,
-                                                            ctx->tmp_tokens_old.data, 0, ctx->tmp_tokens_old.len,
-                                                            ctx->tmp_tokens_new.data, 0, ctx->tmp_tokens_new.len));
+        push_change_set(ctx, CHANGE_TYPE_SUB, old_range->start, old_range->len, new_range->start, new_range->len);
       } else {
-        rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_DEL, ctx->rb_old, Qnil,
-                                                        ctx->tmp_tokens_old.data, 0, ctx->tmp_tokens_old.len,
-                                                        NULL, 0, 0));
-        rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_ADD, Qnil, ctx->rb_new,
-                                                        NULL, 0, 0,
-                                                        ctx->tmp_tokens_new.data, 0, ctx->tmp_tokens_new.len));
+        // the deletion comes first, so the new side has not moved yet
+        push_change_set(ctx, CHANGE_TYPE_DEL, old_range->start, old_range->len, new_range->start, 0);
+        push_change_set(ctx, CHANGE_TYPE_ADD, old_range->end, 0, new_range->start, new_range->len);
       }
-
-      /* FIXME: we have a choice how to align old and new here
-         at this point it stupidliy aligns at the beginning */
-      // uint32_t common_len = MIN(ctx->tmp_tokens_new.len, ctx->tmp_tokens_old.len);
-      // rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_MOD, ctx->rb_old, ctx->rb_new,
-      //                                                     ctx->tmp_tokens_old.data, 0, common_len,
-      //                                                     ctx->tmp_tokens_new.data, 0, common_len));
-      // if(common_len < ctx->tmp_tokens_old.len) {
-      //   rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_DEL, ctx->rb_old, Qnil,
-      //                                                       ctx->tmp_tokens_old.data, common_len, ctx->tmp_tokens_old.len - common_len,
-      //                                                       NULL, 0, 0));
-      // } else if(common_len < ctx->tmp_tokens_new.len) {
-      //   rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_ADD, Qnil, ctx->rb_new,
-      //                                                       NULL, 0, 0,
-      //                                                       ctx->tmp_tokens_new.data, common_len, ctx->tmp_tokens_new.len - common_len));
-      // }
     }
   }
+}
 
+#define SUBTREE_ANCHOR_MIN_LEN 16
+#define SUBTREE_HASH_MUL 0x100000001b3ULL
 
-  // //FIXME: splitting modification is tricky...                    
-  // if(change_type == CHANGE_TYPE_MOD || change_type == CHANGE_TYPE_EQL) {
-  // } else {
-  //   size_t start, len;
-  //   TokenArray *tokens;
-  //   VALUE rb_input;
-  //   switch(change_type) {
-  //     case CHANGE_TYPE_ADD: {
-  //       start = start_new;
-  //       len = len_new;
-  //       tokens = &ctx->tokens_new;
-  //       rb_input = ctx->rb_new;
-  //       break;
-  //     }
-  //     case CHANGE_TYPE_DEL: {
-  //       start = start_old;
-  //       len = len_old;
-  //       tokens = &ctx->tokens_old;
-  //       rb_input = ctx->rb_old;
-  //       break;
-  //     }
-  //     default: {
-  //       rb_raise(rb_eRuntimeError, "unexpected change type");
-  //     }
-  //   }
-
-  //   size_t end = start + len;
-  //   size_t next_start = start;
-
-  //   // for(size_t i = start; i < end; i++) {
-  //   //   Token *token = &tokens->data[i];
-  //   //   if(token->before_newline) {
-  //   //     rb_ary_push(rb_out_ary, rb_change_set_new(change_type, rb_input, tokens, next_start, i - next_start + 1));
-  //   //     next_start = i + 1;
-  //   //   }
-  //   // }
-
-  //   if(next_start < end) {
-  //     rb_ary_push(ctx->rb_out_ary, rb_change_set_new(change_type, rb_input, tokens, next_start, end - next_start));
-  //   }
-  // }
-}
-
-
-// static void
-// change_set_from_tree(DiffContext *ctx, uint32_t root_idx, VALUE rb_ary) {
-//   // empty node
-//   if(root_idx == 0) {
-//     return;
-//   }
-
-//   ChangeSetTree *tree = &ctx->change_set_trees.data[root_idx];
-
-//   if(tree->change_type == CHANGE_TYPE_MOD || tree->change_type == CHANGE_TYPE_EQL) {
-//     if(tree->change_type == CHANGE_TYPE_MOD || (tree->change_type ==CHANGE_TYPE_EQL && ctx->output_eq)) {
-//       rb_ary_push(rb_ary, rb_change_set_new_full(tree->change_type, ctx->rb_old, ctx->rb_new,
-//                                                   &ctx->tokens_old, tree->start_old, tree->len_old,
-//                                                   &ctx->tokens_new, tree->start_new, tree->len_new));
-//     }
-//   } else {
-//     size_t start, len;
-//     TokenArray *tokens;
-//     VALUE rb_input;
-//     switch(tree->change_type) {
-//       case CHANGE_TYPE_ADD: {
-//         start = tree->start_new;
-//         len = tree->len_new;
-//         tokens = &ctx->tokens_new;
-//         rb_input = ctx->rb_new;
-//         break;
-//       }
-//       case CHANGE_TYPE_DEL: {
-//         start = tree->start_old;
-//         len = tree->len_old;
-//         tokens = &ctx->tokens_old;
-//         rb_input = ctx->rb_old;
-//         break;
-//       }
-//       default: {
-//         rb_raise(rb_eRuntimeError, "unexpected change type %d", tree->change_type);
-//       }
-//     }
-//     size_t end = start + len;
-//     rb_ary_push(rb_ary, rb_change_set_new(tree->change_type, rb_input, tokens, start, end - start));
-//   }
-
-//   change_set_from_tree(ctx, tree->children[0], rb_ary);
-//   change_set_from_tree(ctx, tree->children[1], rb_ary);
-// }
-
-// static void
-// output_change_set(DiffContext *ctx, ChangeType change_type, size_t start_old, size_t len_old, size_t start_new, size_t len_new) {
-
-//   //FIXME: splitting modification is tricky...                    
-//   if(change_type == CHANGE_TYPE_MOD || change_type == CHANGE_TYPE_EQL || !ctx->split_lines) {
-//     rb_ary_push(ctx->rb_out_ary, rb_change_set_new_full(change_type, ctx->rb_old, ctx->rb_new,
-//                                                         &ctx->tokens_old, start_old, len_old,
-//                                                         &ctx->tokens_new, start_new, len_new));
-//   } else {
-//     size_t start, len;
-//     TokenArray *tokens;
-//     VALUE rb_input;
-//     switch(change_type) {
-//       case CHANGE_TYPE_ADD: {
-//         start = start_new;
-//         len = len_new;
-//         tokens = &ctx->tokens_new;
-//         rb_input = ctx->rb_new;
-//         break;
-//       }
-//       case CHANGE_TYPE_DEL: {
-//         start = start_old;
-//         len = len_old;
-//         tokens = &ctx->tokens_old;
-//         rb_input = ctx->rb_old;
-//         break;
-//       }
-//       default: {
-//         rb_raise(rb_eRuntimeError, "unexpected change type");
-//       }
-//     }
-
-//     size_t end = start + len;
-//     size_t next_start = start;
-
-//     // for(size_t i = start; i < end; i++) {
-//     //   Token *token = &tokens->data[i];
-//     //   if(token->before_newline) {
-//     //     rb_ary_push(rb_out_ary, rb_change_set_new(change_type, rb_input, tokens, next_start, i - next_start + 1));
-//     //     next_start = i + 1;
-//     //   }
-//     // }
-
-//     if(next_start < end) {
-//       rb_ary_push(ctx->rb_out_ary, rb_change_set_new(change_type, rb_input, tokens, next_start, end - next_start));
-//     }
-//   }
-// }
-
-
-// static void
-// index_old(DiffContext *ctx, uint32_t start_old, uint32_t len_old, uint32_t start_new, uint32_t len_new) {
-//   st_clear(ctx->old_index_map);
-//   ctx->index_list.len = 0;
-
-//   for(size_t iold = start_old; iold < start_old + len_old; iold++) {
-//     Token *token = &ctx->tokens_old.data[iold];
-
-//     IndexKey *key = &ctx->table_entries_old[iold];
-//     key->start_byte = token->start_byte;
-//     key->end_byte = token->end_byte;
-//     key->input = ctx->input_old;
-
-//     UpdateArg arg = {
-//       .index_list = &ctx->index_list,
-//       .value = iold,
-//     };
-
-//     st_update(ctx->old_index_map, (st_data_t) key, update_callback, (st_data_t) &arg);
-//   }
-// }
-
+// A named subtree spanning the tokens [start, start + len) of one side
 typedef struct {
-  int64_t left;
-  int64_t right;
-  int64_t top;
-  int64_t bottom;
-} Box;
+  uint64_t hash;
+  uint32_t start;
+  uint32_t len;
+} Subtree;
 
 typedef struct {
-  int64_t x1;
-  int64_t y1;
-  int64_t x2;
-  int64_t y2;
-} Snake;
-
-
-#define BOX_WIDTH(b) (b->right - b->left)
-#define BOX_HEIGHT(b) (b->bottom - b->top)
-#define BOX_SIZE(b) (BOX_WIDTH(b) + BOX_HEIGHT(b))
-#define BOX_DELTA(b) (BOX_WIDTH(b) - BOX_HEIGHT(b))
+  Subtree *data;
+  uint32_t len;
+  uint32_t capa;
+} SubtreeArray;
 
-#define VGET(v, i) (v[(i) < 0 ? ((i) + (vlen)) : (i)])
-#define VSET(v, i, val) (v[(i) < 0 ? ((i) + (vlen)) : (i)] = val)
+// A subtree found unchanged on both sides
+typedef struct {
+  uint32_t x;
+  uint32_t y;
+  uint32_t len;
+} SubtreeAnchor;
 
-static bool
-forward(DiffContext *ctx, Box *box, int64_t *vf, int64_t *vb, int64_t d, int64_t vlen, Snake *snake) {
-  for(int64_t k = d; k >= -d; k -= 2) {
-    int64_t c = k - BOX_DELTA(box);
-    int64_t px, x, y, py;
+static void
+subtree_array_push(SubtreeArray *array, Subtree subtree) {
+  if(!(array->len < array->capa)) {
+    uint32_t new_capa = 2 * array->capa;
+    ENGINE_REALLOC_N(array->data, Subtree, new_capa);
+    array->capa = new_capa;
+  }
+  array->data[array->len++] = subtree;
+}
 
-    if(k == -d || (k != d && VGET(vf, k - 1) < VGET(vf, k + 1))) {
-      px = x = VGET(vf, k + 1);
-    }
-    else {
-      px = VGET(vf, k - 1);
-      x  = px + 1;
-    }
+/* Collects the named subtrees of at least min_len tokens lying within
+   tokens [start, end), bottom-up from the leaves. Every subtree is found
+   from its first token, whose ancestors are followed as long as they start
+   there too. Starts are relative to start, like ids_old_ and ids_new_ */
+static void
+collect_subtrees(Token *tokens, size_t tokens_len, TokenId *ids, uint32_t start, uint32_t end,
+                 uint32_t min_len, uint64_t *hashes, uint64_t *powers, SubtreeArray *subtrees) {
+  // hashes[i] is the hash of the first i tokens, so ranges hash in O(1)
+  hashes[0] = 0;
+  for(uint32_t i = start; i < end; i++) {
+    hashes[i - start + 1] = hashes[i - start] * SUBTREE_HASH_MUL + ids[i] + 1;
+  }
 
-    y = box->top + (x - box->left) - k;
-    py = (d == 0 || x != px) ? y : y - 1;
+  for(uint32_t i = start; i < end; i++) {
+    TSNode node = tokens[i].ts_node;
+    uint32_t last_end = i;
+
+    if(ts_node_is_null(node)) continue;
+
+    while(true) {
+      node = ts_node_parent(node);
+      if(ts_node_is_null(node)) break;
+
+      // the node started at an earlier token, and so did its ancestors
+      uint32_t node_start = ts_node_start_byte(node);
+      if(i > 0 && tokens[i - 1].start_byte >= node_start) break;
+
+      uint32_t node_end = ts_node_end_byte(node);
+      size_t lo = i + 1, hi = tokens_len;
+      while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(tokens[mid].start_byte < node_end) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
 
-    while(x < box->right && y < box->bottom && token_eql(&ctx->tokens_old_[x], ctx->input_old, &ctx->tokens_new_[y], ctx->input_new)) {
-      x++;
-      y++;
-    }
+      if(lo > end) break;
 
-    VSET(vf, k, x);
+      // wrapper nodes spanning the same tokens as their child are skipped
+      uint32_t node_len = (uint32_t) lo - i;
+      if(lo == last_end || node_len < min_len || !ts_node_is_named(node)) continue;
+      last_end = (uint32_t) lo;
 
-    if(BOX_DELTA(box) % 2 != 0 && (c >= -(d - 1) && c <= d - 1) && y >= VGET(vb, c)) {
-      *snake = (Snake){px, py, x, y};
-      return true;
+      uint32_t rel_start = i - start;
+      uint64_t hash = hashes[rel_start + node_len] - hashes[rel_start] * powers[node_len];
+      subtree_array_push(subtrees, (Subtree) {hash, rel_start, node_len});
     }
   }
-  return false;
 }
 
+static int
+subtree_cmp(const void *x, const void *y) {
+  const Subtree *a = x;
+  const Subtree *b = y;
+  if(a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+  if(a->len != b->len) return a->len < b->len ? -1 : 1;
+  return 0;
+}
 
-static bool
-backward(DiffContext *ctx, Box *box, int64_t *vf, int64_t *vb, int64_t d, int64_t vlen, Snake *snake) {
-  for(int64_t c = d; c >= -d; c -= 2) {
-    int64_t k = c + BOX_DELTA(box);
-    int64_t px, x, y, py;
+static int
+subtree_anchor_len_cmp(const void *x, const void *y) {
+  const SubtreeAnchor *a = x;
+  const SubtreeAnchor *b = y;
+  if(a->len != b->len) return a->len > b->len ? -1 : 1;
+  if(a->x != b->x) return a->x < b->x ? -1 : 1;
+  return 0;
+}
 
-    if(c == -d || (c != d && VGET(vb, c - 1) > VGET(vb, c + 1))) {
-      py = y = VGET(vb, c + 1);
+/* Pairs up the subtrees occurring exactly once on either side and keeps,
+   largest first, those not overlapping or crossing the ones kept before.
+   Subtree starts are relative to start_old and start_new. Returns the kept
+   anchors, ordered on both sides */
+static uint32_t
+subtree_anchors(DiffContext *ctx, uint32_t start_old, uint32_t start_new,
+                SubtreeArray *subtrees_old, SubtreeArray *subtrees_new, SubtreeAnchor **out_anchors) {
+  qsort(subtrees_old->data, subtrees_old->len, sizeof(Subtree), subtree_cmp);
+  qsort(subtrees_new->data, subtrees_new->len, sizeof(Subtree), subtree_cmp);
+
+  SubtreeAnchor *candidates = ENGINE_ALLOC_N(SubtreeAnchor, MAX(1, MIN(subtrees_old->len, subtrees_new->len)));
+  uint32_t candidates_len = 0;
+
+  for(uint32_t i = 0, j = 0; i < subtrees_old->len && j < subtrees_new->len;) {
+    Subtree *old_subtree = &subtrees_old->data[i];
+    Subtree *new_subtree = &subtrees_new->data[j];
+    int cmp = subtree_cmp(old_subtree, new_subtree);
+    if(cmp < 0) {
+      i++;
+      continue;
     }
-    else {
-      py = VGET(vb, c - 1);
-      y  = py - 1;
+    if(cmp > 0) {
+      j++;
+      continue;
     }
 
-    x = box->left + (y - box->top) + k;
-    px = (d == 0 || y != py) ? x : x + 1;
+    uint32_t old_count = 1, new_count = 1;
+    while(i + old_count < subtrees_old->len && !subtree_cmp(old_subtree, &subtrees_old->data[i + old_count])) old_count++;
+    while(j + new_count < subtrees_new->len && !subtree_cmp(new_subtree, &subtrees_new->data[j + new_count])) new_count++;
 
-    while(x > box->left && y > box->top && token_eql(&ctx->tokens_old_[x - 1], ctx->input_old, &ctx->tokens_new_[y - 1], ctx->input_new)) {
-      x--;
-      y--;
+    // hashes can collide, the tokens cannot
+    if(old_count == 1 && new_count == 1 &&
+       !memcmp(ctx->engine.ids_old_ + start_old + old_subtree->start, ctx->engine.ids_new_ + start_new + new_subtree->start,
+               old_subtree->len * sizeof(TokenId))) {
+      candidates[candidates_len++] = (SubtreeAnchor) {old_subtree->start, new_subtree->start, old_subtree->len};
     }
 
-    VSET(vb, c, y);
+    i += old_count;
+    j += new_count;
+  }
+
+  qsort(candidates, candidates_len, sizeof(SubtreeAnchor), subtree_anchor_len_cmp);
 
-    if(BOX_DELTA(box) % 2 == 0 && (k >= -d && k <= d) && x <= VGET(vf, k)) {
-      *snake = (Snake){x, y, px, py};
-      return true;
+  // kept ordered by x, so only the neighbours of a candidate need checking
+  SubtreeAnchor *anchors = ENGINE_ALLOC_N(SubtreeAnchor, MAX(1, candidates_len));
+  uint32_t anchors_len = 0;
+
+  for(uint32_t i = 0; i < candidates_len; i++) {
+    SubtreeAnchor *candidate = &candidates[i];
+    uint32_t lo = 0, hi = anchors_len;
+    while(lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if(anchors[mid].x < candidate->x) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
     }
-  }
-  return false;
-}
 
-static bool
-midpoint(DiffContext *ctx, Box *box, Snake *snake) {
-  if(BOX_SIZE(box) == 0) return false;
-
-  int64_t max = (BOX_SIZE(box) + 1) / 2;
-  int64_t vlen = 2 * max + 1;
-  int64_t *vf_vb = RB_ZALLOC_N(int64_t, 2 * vlen);
-  int64_t *vf = vf_vb + 0;
-  int64_t *vb = vf_vb + vlen;
-  bool retval = false;
-
-  vf[1] = box->left;
-  vb[1] = box->bottom;
-
-  for(int64_t d = 0; d <= max; d++) {
-    if(forward(ctx, box, vf, vb, d, vlen, snake)) {
-      retval = true;
-      goto done;
+    if(lo > 0) {
+      SubtreeAnchor *prev = &anchors[lo - 1];
+      if(prev->x + prev->len > candidate->x || prev->y + prev->len > candidate->y) continue;
     }
-    if(backward(ctx, box, vf, vb, d, vlen, snake)) {
-      retval = true;
-      goto done;
+
+    if(lo < anchors_len) {
+      SubtreeAnchor *next = &anchors[lo];
+      if(candidate->x + candidate->len > next->x || candidate->y + candidate->len > next->y) continue;
     }
+
+    memmove(anchors + lo + 1, anchors + lo, (anchors_len - lo) * sizeof(SubtreeAnchor));
+    anchors[lo] = *candidate;
+    anchors_len++;
   }
 
-done:
-  xfree(vf_vb);
-  return retval;
+  ENGINE_FREE(candidates);
+  *out_anchors = anchors;
+  return anchors_len;
 }
 
+/* Matches unchanged named subtrees between both sides before the token level
+   diff, which then only runs on the gaps between them */
+static void
+walk_subtrees(DiffContext *ctx, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new) {
+  uint32_t offset = (uint32_t) ctx->engine.prefix_len;
+  uint32_t max_len = MAX(end_old, end_new);
+  uint64_t *hashes = ENGINE_ALLOC_N(uint64_t, max_len + 1);
+  uint64_t *powers = ENGINE_ALLOC_N(uint64_t, max_len + 1);
+  SubtreeArray subtrees_old, subtrees_new;
+  SubtreeAnchor *anchors;
+
+  powers[0] = 1;
+  for(uint32_t i = 1; i <= max_len; i++) {
+    powers[i] = powers[i - 1] * SUBTREE_HASH_MUL;
+  }
 
-static PathIdx
-find_path(DiffContext *ctx, int64_t left, int64_t top, int64_t right, int64_t bottom) {
-  Box box = {
-    .left = left,
-    .top = top,
-    .right = right,
-    .bottom = bottom
-  };
-  Snake snake;
-  if(!midpoint(ctx, &box, &snake)) {
-    return 0;
-  } 
+  subtrees_old.data = ENGINE_ALLOC_N(Subtree, 64);
+  subtrees_old.capa = 64;
+  subtrees_old.len = 0;
+  subtrees_new.data = ENGINE_ALLOC_N(Subtree, 64);
+  subtrees_new.capa = 64;
+  subtrees_new.len = 0;
+
+  collect_subtrees(ctx->tokens_old.data, ctx->tokens_old.len, ctx->engine.ids_old, offset + start_old, offset + end_old,
+                   ctx->anchor_min_len, hashes, powers, &subtrees_old);
+  collect_subtrees(ctx->tokens_new.data, ctx->tokens_new.len, ctx->engine.ids_new, offset + start_new, offset + end_new,
+                   ctx->anchor_min_len, hashes, powers, &subtrees_new);
+
+  uint32_t anchors_len = subtree_anchors(ctx, start_old, start_new, &subtrees_old, &subtrees_new, &anchors);
+
+  ENGINE_FREE(subtrees_new.data);
+  ENGINE_FREE(subtrees_old.data);
+  ENGINE_FREE(powers);
+  ENGINE_FREE(hashes);
+
+  uint32_t x = start_old, y = start_new;
+  for(uint32_t i = 0; i < anchors_len && !ctx->engine.interrupted; i++) {
+    SubtreeAnchor *anchor = &anchors[i];
+    diff_engine_walk(&ctx->engine, x, start_old + anchor->x, y, start_new + anchor->y);
+    diff_engine_walk_equal(&ctx->engine, start_old + anchor->x, start_new + anchor->y, anchor->len);
+    x = start_old + anchor->x + anchor->len;
+    y = start_new + anchor->y + anchor->len;
+  }
+
+  if(!ctx->engine.interrupted) {
+    diff_engine_walk(&ctx->engine, x, end_old, y, end_new);
+  }
 
-  int64_t start_x = snake.x1, start_y = snake.y1, finish_x = snake.x2, finish_y = snake.y2;
+  ENGINE_FREE(anchors);
+}
 
-  assert(!(start_x == right && start_y == bottom));
+// First token ending after byte, minus one so that a token just touching an edit is included
+static int64_t
+edit_window_first_token(TokenArray *tokens, int64_t byte) {
+  size_t lo = 0, hi = tokens->len;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(tokens->data[mid].end_byte <= byte) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo > 0 ? (int64_t) lo - 1 : 0;
+}
 
-  PathIdx head_idx = find_path(ctx, box.left, box.top, start_x, start_y);
-  PathIdx tail_idx = find_path(ctx, finish_x, finish_y, box.right, box.bottom);
+// First token starting at or after byte, plus one for the same reason
+static int64_t
+edit_window_end_token(TokenArray *tokens, int64_t byte) {
+  size_t lo = 0, hi = tokens->len;
+  while(lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if(tokens->data[mid].start_byte < byte) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return MIN((int64_t) lo + 1, (int64_t) tokens->len);
+}
 
-  if(head_idx == 0) {
-    Path *head;
-    head_idx = path_array_push(&ctx->path_array, &head);
-    head->x = start_x;
-    head->y = start_y;
+/* Strips the common prefix and suffix like trim_tokens, but without
+   interning: they can only reach the first and last edit window, and
+   their tokens are compared by contents. Returns false if nothing is left */
+static bool
+trim_edits(DiffContext *ctx) {
+  TokenArray *old = &ctx->tokens_old, *new = &ctx->tokens_new;
+  Box *first = &ctx->edit_windows[0];
+  Box *last = &ctx->edit_windows[ctx->edit_windows_len - 1];
+
+  size_t prefix_max = (size_t) MIN(edit_window_first_token(old, first->left), edit_window_first_token(new, first->top));
+  size_t prefix_len = 0;
+  while(prefix_len < prefix_max &&
+        token_eql(&old->data[prefix_len], ctx->input_old, &new->data[prefix_len], ctx->input_new)) {
+    prefix_len++;
   }
 
-  if(tail_idx == 0) {
-    Path *tail;
-    tail_idx = path_array_push(&ctx->path_array, &tail);
-    tail->x = finish_x;
-    tail->y = finish_y;
+  size_t old_min = MAX((size_t) edit_window_end_token(old, last->right), prefix_len);
+  size_t new_min = MAX((size_t) edit_window_end_token(new, last->bottom), prefix_len);
+  size_t suffix_len = 0;
+  while(old->len - suffix_len > old_min && new->len - suffix_len > new_min &&
+        token_eql(&old->data[old->len - suffix_len - 1], ctx->input_old,
+                  &new->data[new->len - suffix_len - 1], ctx->input_new)) {
+    suffix_len++;
   }
 
-  PathIdx iter_idx = head_idx;
-  while(true) {
-    Path *iter = path_array_get(&ctx->path_array, iter_idx);
-    if(!iter->next) {
-      iter->next = tail_idx;
-      break;
-    } else {
-      iter_idx = iter->next;
-    }
+  ctx->engine.prefix_len = prefix_len;
+  ctx->engine.suffix_len = suffix_len;
+  if(prefix_len == old->len && prefix_len == new->len) {
+    return false;
   }
 
-  return head_idx;
+  ctx->engine.ids_old_ = ctx->engine.ids_old + prefix_len;
+  ctx->engine.ids_new_ = ctx->engine.ids_new + prefix_len;
+  ctx->tokens_old_ = old->data + prefix_len;
+  ctx->tokens_new_ = new->data + prefix_len;
+  return true;
 }
 
+/* Diffs only the tokens around the edit windows. The tokens between
+   windows are expected to be unchanged and are compared by contents;
+   where they are not, as when an edit changed how the rest of the file
+   parses, everything from the first mismatch to the end of the next
+   window is diffed as well. Only the diffed tokens are interned */
 static void
-call_cb(DiffContext *ctx, int64_t x1, int64_t y1, int64_t x2, int64_t y2) {
-  CallbackType type;
-  Token *token_old = NULL, *token_new = NULL;
-  if(x1 == x2) {
-    type = CALLBACK_INS;
-    token_new = &ctx->tokens_new_[y1];
-  } else if(y1 == y2) {
-    type = CALLBACK_DEL;
-    token_old = &ctx->tokens_old_[x1];
-  } else {
-    type = CALLBACK_EQ;
-    token_old = &ctx->tokens_old_[x1];
-    token_new = &ctx->tokens_new_[y1];
+walk_edits(DiffContext *ctx, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new) {
+  int64_t offset = ctx->engine.prefix_len;
+  int64_t x = start_old, y = start_new;
+  TokenDict dict;
+
+  token_dict_init(&dict, 64);
+
+  for(uint32_t i = 0; i <= ctx->edit_windows_len && !ctx->engine.interrupted; i++) {
+    int64_t left = end_old, right = end_old, top = end_new, bottom = end_new;
+
+    if(i < ctx->edit_windows_len) {
+      Box *window = &ctx->edit_windows[i];
+      left = edit_window_first_token(&ctx->tokens_old, window->left) - offset;
+      right = edit_window_end_token(&ctx->tokens_old, window->right) - offset;
+      top = edit_window_first_token(&ctx->tokens_new, window->top) - offset;
+      bottom = edit_window_end_token(&ctx->tokens_new, window->bottom) - offset;
+      left = MIN(MAX(left, x), end_old);
+      right = MIN(MAX(right, left), end_old);
+      top = MIN(MAX(top, y), end_new);
+      bottom = MIN(MAX(bottom, top), end_new);
+    }
+
+    int64_t equal_len = 0;
+    while(x + equal_len < left && y + equal_len < top &&
+          token_eql(&ctx->tokens_old_[x + equal_len], ctx->input_old, &ctx->tokens_new_[y + equal_len], ctx->input_new)) {
+      equal_len++;
+    }
+    diff_engine_walk_equal(&ctx->engine, x, y, equal_len);
+    x += equal_len;
+    y += equal_len;
+
+    right = MAX(x, right);
+    bottom = MAX(y, bottom);
+    intern_token_range(ctx, &dict, false, offset + x, offset + right);
+    intern_token_range(ctx, &dict, true, offset + y, offset + bottom);
+    ctx->engine.distinct_ids = dict.len;
+
+    diff_engine_walk(&ctx->engine, x, right, y, bottom);
+    x = right;
+    y = bottom;
   }
 
-  ctx->cb(ctx, type, token_old, token_new);
+  token_dict_destroy(&dict);
 }
 
-static void
-walk_diagonal(DiffContext *ctx, int64_t x1, int64_t y1, int64_t x2, int64_t y2, int64_t *out_x1, int64_t *out_y1) {
-  while(x1 < x2 && y1 < y2 && token_eql(&ctx->tokens_old_[x1], ctx->input_old, &ctx->tokens_new_[y1], ctx->input_new)) {
-    call_cb(ctx, x1, y1, x1 + 1, y1 + 1);
-    x1++;
-    y1++;
+static uint32_t
+collect_lines(Token *tokens, uint32_t start, uint32_t end, TokenLine *lines) {
+  uint32_t lines_len = 0;
+  uint32_t line_start = start;
+
+  for(uint32_t i = start; i < end; i++) {
+    if(tokens[i].before_newline || i + 1 == end) {
+      lines[lines_len++] = (TokenLine) {
+        .start = line_start,
+        .len = i + 1 - line_start,
+      };
+      line_start = i + 1;
+    }
   }
-  *out_x1 = x1;
-  *out_y1 = y1;
+  return lines_len;
 }
 
-// static void
-// free_path(Path *path) {
-//   if(path->next != NULL) {
-//     free_path(path->next);
-//   }
-//   xfree(path);
-// }
-
-static void 
-walk_snakes(DiffContext *ctx, uint32_t start_old, uint32_t len_old, uint32_t start_new, uint32_t len_new) {
-  PathIdx path_idx = find_path(ctx, start_old, start_new, len_old, len_new);
-  if(path_idx == 0) return;
-
-  int64_t x1, y1, x2, y2;
-  PathIdx iter_idx = path_idx;
-  Path *iter;
-
-  iter = path_array_get(&ctx->path_array, iter_idx);
-  x1 = iter->x;
-  y1 = iter->y;
-  iter_idx = iter->next;
-  iter = path_array_get(&ctx->path_array, iter_idx);
-  x2 = iter->x;
-  y2 = iter->y;
-  iter_idx = iter->next;
-
-  while(true) {
-    // fprintf(stderr, "%d %d %d %d\n", x1, y1, x2, y2);
-
-    walk_diagonal(ctx, x1, y1, x2, y2, &x1, &y1);
-    int64_t d = (x2 - x1) - (y2 - y1);
-    if(d < 0) {
-      call_cb(ctx, x1, y1, x1, y1 + 1);
-      y1++;
-    } else if(d > 0) {
-      call_cb(ctx, x1, y1, x1 + 1, y1);
-      x1++;
-    }
-    walk_diagonal(ctx, x1, y1, x2, y2, &x1, &y1);
+/* Splits the tokens into lines for the two-level diff of the engine,
+   see diff_engine_walk_lines */
+static void
+walk_lines(DiffContext *ctx, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new) {
+  TokenLine *lines_old = ENGINE_ALLOC_N(TokenLine, MAX(end_old - start_old, 1));
+  TokenLine *lines_new = ENGINE_ALLOC_N(TokenLine, MAX(end_new - start_new, 1));
+  uint32_t lines_old_len = collect_lines(ctx->tokens_old_, start_old, end_old, lines_old);
+  uint32_t lines_new_len = collect_lines(ctx->tokens_new_, start_new, end_new, lines_new);
 
-    if(iter_idx == 0) {
-      break;
-    } else {
-      x1 = x2;
-      y1 = y2;
-      iter = path_array_get(&ctx->path_array, iter_idx);
-      x2 = iter->x;
-      y2 = iter->y;
-      iter_idx = iter->next;
-    }
-  } 
+  diff_engine_walk_lines(&ctx->engine, lines_old, lines_old_len, lines_new, lines_new_len, end_old, end_new);
 
-  // free_path(path);
+  ENGINE_FREE(lines_old);
+  ENGINE_FREE(lines_new);
 }
 
 static void 
 collect_change_sets(DiffContext *ctx, CallbackType type, Token *token_old, Token *token_new) {
   switch(type) {
     case CALLBACK_START:
-      tmp_token_array_reset(&ctx->tmp_tokens_new);
-      tmp_token_array_reset(&ctx->tmp_tokens_old);
+      tmp_token_range_reset(&ctx->tmp_tokens_new);
+      tmp_token_range_reset(&ctx->tmp_tokens_old);
       break;
     case CALLBACK_FINISH:
-      // fprintf(stderr, "FINISH\n");
       output_change_set(ctx);
       break;
     case CALLBACK_DEL:
-      // fprintf(stderr, "token_old DEL (%d): %d-%d %.*s\n", token_old->implicit, token_old->start_byte, token_old->end_byte, token_old->end_byte - token_old->start_byte, ctx->input_old + token_old->start_byte);
-      add_tmp_token(&ctx->tmp_tokens_old, *token_old, type);
+      add_tmp_token(&ctx->tmp_tokens_old, (uint32_t) (token_old - ctx->tokens_old.data), type);
+      ctx->tmp_tokens_old.end = (uint32_t) (token_old - ctx->tokens_old.data) + 1;
       break;
     case CALLBACK_EQ:
       output_change_set(ctx);
-      // fprintf(stderr, "token EQ (%d): %.*s\n", token_old->implicit, token_old->end_byte - token_old->start_byte, ctx->input_old + token_old->start_byte);
-      // fprintf(stderr, "token EQ (%d): %.*s\n", token_new->implicit, token_new->end_byte - token_new->start_byte, ctx->input_new + token_new->start_byte);
-      // fprintf(stderr, "RESET\n");
-      tmp_token_array_reset(&ctx->tmp_tokens_new);
-      tmp_token_array_reset(&ctx->tmp_tokens_old);
+      tmp_token_range_reset(&ctx->tmp_tokens_new);
+      tmp_token_range_reset(&ctx->tmp_tokens_old);
       if(ctx->output_eq) {
-        add_tmp_token(&ctx->tmp_tokens_old, *token_old, type);
-        add_tmp_token(&ctx->tmp_tokens_new, *token_new, type);
+        add_tmp_token(&ctx->tmp_tokens_old, (uint32_t) (token_old - ctx->tokens_old.data), type);
+        add_tmp_token(&ctx->tmp_tokens_new, (uint32_t) (token_new - ctx->tokens_new.data), type);
       }
+      ctx->tmp_tokens_old.end = (uint32_t) (token_old - ctx->tokens_old.data) + 1;
+      ctx->tmp_tokens_new.end = (uint32_t) (token_new - ctx->tokens_new.data) + 1;
       break;
     case CALLBACK_INS:
-      // fprintf(stderr, "token_new INS (%d): %.*s\n", token_new->implicit, token_new->end_byte - token_new->start_byte, ctx->input_new + token_new->start_byte);
-      add_tmp_token(&ctx->tmp_tokens_new, *token_new, type);
+      add_tmp_token(&ctx->tmp_tokens_new, (uint32_t) (token_new - ctx->tokens_new.data), type);
+      ctx->tmp_tokens_new.end = (uint32_t) (token_new - ctx->tokens_new.data) + 1;
       break;
   }
+}
+
+static void
+replay_edit_ops(DiffContext *ctx) {
+  EditScript *script = &ctx->engine.edit_script;
 
+  ctx->cb = collect_change_sets;
+  for(uint32_t i = 0; i < script->len; i++) {
+    EditOp *op = &script->data[i];
+    // without output_eq an EQ token only moves the ends, so the last one stands in for the run
+    uint32_t first = (op->type == CALLBACK_EQ && !ctx->output_eq && op->len > 0) ? op->len - 1 : 0;
+    for(uint32_t j = first; j < op->len; j++) {
+      Token *token_old = op->type != CALLBACK_INS ? &ctx->tokens_old.data[op->old_idx + j] : NULL;
+      Token *token_new = op->type != CALLBACK_DEL ? &ctx->tokens_new.data[op->new_idx + j] : NULL;
+      ctx->cb(ctx, op->type, token_old, token_new);
+    }
+  }
 }
 
 static void
-token_diff2(DiffContext *ctx, uint32_t start_old, uint32_t len_old, uint32_t start_new, uint32_t len_new) {
+replay_edit_script(DiffContext *ctx) {
   ctx->cb = collect_change_sets;
   ctx->cb(ctx, CALLBACK_START, NULL, NULL);
-  walk_snakes(ctx, start_old, len_old, start_new, len_new);
+  replay_edit_ops(ctx);
   ctx->cb(ctx, CALLBACK_FINISH, NULL, NULL);
 }
 
 
-// // Loosely based on https://github.com/paulgb/simplediff
-// static uint32_t
-// token_diff(DiffContext *ctx, uint32_t start_old, uint32_t len_old, uint32_t start_new, uint32_t len_new) {
-
-//   if(len_old == 0 && len_new == 0) return 0;
-
-//   // uint32_t sub_start_old = start_old;
-//   // uint32_t sub_start_new = start_new;
-//   uint32_t best_sub_length = 0;
-//   BetterMatchArray better_matches;
-//   better_match_array_init(&better_matches);
-//   // for(size_t i = 0; i < ctx->tokens_new.len; i++) {
-//   //   Token *token = &ctx->tokens_new.data[i];
-//   //   fprintf(stderr, "TOKEN NEW (%d): %.*s\n", token->implicit, token->end_byte - token->start_byte, ctx->input_new + token->start_byte);
-//   //   if(token->before_newline) {
-//   //     fprintf(stderr, "BEFORE NEWLINE\n");
-//   //   }
-//   // }
-
-//   // for(size_t i = 0; i < ctx->tokens_old.len; i++) {
-//   //   Token *token = &ctx->tokens_old.data[i];
-//   //   fprintf(stderr, "TOKEN OLD (%d): %.*s\n", token->implicit, token->end_byte - token->start_byte, ctx->input_old + token->start_byte);
-//   //   if(token->before_newline) {
-//   //     fprintf(stderr, "BEFORE NEWLINE\n");
-//   //   }
-//   // }
-
-//   if(len_old > 0) {
-//     // st_clear(next_match_map);
-//     // st_clear(match_map);
-//     match_map_reset(&ctx->next_match_map);
-//     match_map_reset(&ctx->match_map);
-
-//     index_old(ctx, start_old, len_old, start_new, len_new);
-
-
-//     for(size_t inew = start_new; inew < start_new + len_new; inew++) {
-//       Token *token = &ctx->tokens_new.data[inew];
-
-//     //  fprintf(stderr, "TOKEN NEW: %.*s %d\n", token->end_byte - token->start_byte, input_new + token->start_byte, inew);
-//     //   if(token->before_newline) {
-//     //      fprintf(stderr, "HAVE FOUND NEWLINE TOKEN\n");
-//     //     //  abort();
-//     //   }
-
-//       // assert(next_match_map->num_entries == 0);
-
-//       IndexKey key = {
-//         .start_byte = token->start_byte,
-//         .end_byte = token->end_byte,
-//         .input = ctx->input_new
-//       };
-
-//       st_data_t pair;
-//       // uint32_t max_new_sub_len = 0;
-
-//       // NOTE: at this point, next_match_map but be fresh, i.e., in a post-reset() state
-
-//       if(st_lookup(ctx->old_index_map, (st_data_t)&key, &pair)) {
-//         while(true) {
-//           uint32_t value = PAIR64_FIRST(pair);
-//           uint32_t next_index = PAIR64_SECOND(pair);
-
-//           uint32_t iold = value;
-
-//           uint32_t prev_sub_len = 0;
-
-//           if(iold > start_old) {
-//             prev_sub_len = ctx->match_map.data[iold - 1].len;
-//             // st_lookup(match_map, (st_data_t) (iold - 1), (st_data_t *) &prev_sub_len);
-//           }
-
-//           /*if(!(prev_sub_len == 0 && token->dont_start))*/ {
-//             uint32_t new_sub_len = prev_sub_len + 1;
-//             uint32_t new_sub_start_old = iold - new_sub_len + 1;
-//             uint32_t new_sub_start_new = inew - new_sub_len + 1;
-
-//             // bool new_sub_ends_at_newline = false;
-//             // bool cur_sub_ends_at_newline = false;
-
-//             // if(sub_length > 0) {
-//             //   int64_t cur_sub_last_token_index = sub_start_new + sub_length - 1;
-//             //   int64_t new_sub_last_token_index = new_sub_start_new + new_sub_len - 1;
-
-//             //   new_sub_ends_at_newline = new_sub_last_token_index > 0 && tokens_new->data[new_sub_last_token_index].before_newline;
-//             //   cur_sub_ends_at_newline = cur_sub_last_token_index > 0 && tokens_new->data[cur_sub_last_token_index].before_newline;
-//             // }
-
-
-//             if(new_sub_len >= best_sub_length) { // || (new_sub_len == sub_length && !cur_sub_ends_at_newline && new_sub_ends_at_newline)) {
-
-//                 // if(new_sub_len == sub_length && (new_sub_ends_at_newline || !cur_sub_ends_at_newline)) {
-//                 //   fprintf(stderr, "HAVE FOUND NEWLINE TOKEN\n");
-//                 //   fprintf(stderr, "preferring (%d, %d) over (%d, %d)\n", new_sub_start_old, new_sub_len, sub_start_old, sub_length);
-//                 // }
-
-//                 // we need to find the *best* matches
-//                 // but we do not know until fully through the loop
-//                 // so either we go through twice, or we store all 'better' matches
-//                 // and eventually only consider the best
-//                 BetterMatch better_match = {
-//                   .sub_len = new_sub_len,
-//                   .sub_start_old = new_sub_start_old,
-//                   .sub_start_new = new_sub_start_new,
-//                 };
-//                 best_sub_length = new_sub_len;
-//                 // sub_start_old = new_sub_start_old;
-//                 // sub_start_new = new_sub_start_new;
-
-//                 better_match_array_insert(&better_matches, better_match);
-
-//                 // fprintf(stderr, "%d => %d\n", new_sub_start_old, iold - sub_length + 1);
-//                 // fprintf(stderr, "%d => %d\n", new_sub_start_new, inew - sub_length + 1);
-//                 // sub_start_old = iold - sub_length + 1;
-//                 // sub_start_new = inew - sub_length + 1;
-//             }
-//             // assert(best_sub_length <= len_old);
-//             // assert(best_sub_length <= len_new);
-//             // assert(sub_start_old >= start_old);
-//             // assert(sub_start_new >= start_new);
-//             // st_insert(next_match_map, (st_data_t) iold, new_sub_len);
-//             match_map_insert(&ctx->next_match_map, iold, new_sub_len);
-//           }
-
-//           if(next_index == UINT32_MAX) {
-//             break;
-//           } else {
-//             pair = ctx->index_list.entries[next_index];
-//           }
-//         }
-//       }
-
-//       {
-//         MatchMap tmp = ctx->match_map;
-//         ctx->match_map = ctx->next_match_map;
-//         ctx->next_match_map = tmp;
-
-//         match_map_reset(&ctx->next_match_map);
-//         // st_clear(next_match_map);
-//       }
-//     }
-//   }
-
-//   uint32_t ret_tree_idx = UINT32_MAX;
-
-//   if(best_sub_length == 0) {
-//     uint32_t tree_idxs[3] = {0,};
-//     uint64_t cost = 0;
-
-//     size_t common_len = MIN(len_old, len_new);
-//     if(common_len > 0) {
-//       tree_idxs[0] = change_set_tree_array_push(&ctx->change_set_trees);
-//       ChangeSetTree *tree = change_set_tree_array_get(&ctx->change_set_trees, tree_idxs[0]);
-//       tree->change_type = CHANGE_TYPE_MOD;
-//       tree->cost = 2 * common_len;
-//       tree->start_old = start_old;
-//       tree->len_old = common_len;
-//       tree->start_new = start_new;
-//       tree->len_new = common_len;
-//       cost += tree->cost;
-
-//       // output_change_set(ctx, CHANGE_TYPE_MOD,
-//       //                   start_old, common_len,
-//       //                   start_new, common_len);
-
-//       // rb_ary_push(rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_MOD, rb_input_old, rb_input_new,
-//       //                                                tokens_old, start_old, common_len,
-//       //                                                tokens_new, start_new, common_len));
-//       start_old += common_len;
-//       start_new += common_len;
-//       len_old -= common_len;
-//       len_new -= common_len;
-//     }
-
-
-//     if(len_old > 0) {
-//       tree_idxs[1] = change_set_tree_array_push(&ctx->change_set_trees);
-//       ChangeSetTree *tree = change_set_tree_array_get(&ctx->change_set_trees, tree_idxs[1]);
-//       tree->change_type = CHANGE_TYPE_DEL;
-//       tree->cost = len_old;
-//       tree->start_old = start_old;
-//       tree->len_old = len_old;
-//       tree->start_new = 0;
-//       tree->len_new = 0;
-//       cost += tree->cost;
-
-
-//       // rb_ary_push(rb_out_ary, rb_change_set_new(CHANGE_TYPE_DEL, rb_input_old, tokens_old, start_old, len_old));
-//       // output_change_set(ctx, CHANGE_TYPE_DEL,
-//       //                   start_old, len_old,
-//       //                   0, 0);
-//     }
-
-//     if(len_new > 0) {
-//       tree_idxs[2] = change_set_tree_array_push(&ctx->change_set_trees);
-//       ChangeSetTree *tree = change_set_tree_array_get(&ctx->change_set_trees, tree_idxs[2]);
-//       tree->change_type = CHANGE_TYPE_ADD;
-//       tree->cost = len_new;
-//       tree->start_old = 0;
-//       tree->len_old = 0;
-//       tree->start_new = start_new;
-//       tree->len_new = len_new;
-//       cost += tree->cost;
-//       // rb_ary_push(rb_out_ary, rb_change_set_new(CHANGE_TYPE_ADD, rb_input_new, tokens_new, start_new, len_new));
-//       // output_change_set(ctx, CHANGE_TYPE_ADD,
-//       //                   0, 0,
-//       //                   start_new, len_new);
-//     }
-
-//     if(tree_idxs[0] != 0) {
-//       ret_tree_idx = tree_idxs[0];
-//       ChangeSetTree *tree = change_set_tree_array_get(&ctx->change_set_trees, ret_tree_idx);
-//       tree->children[0] = tree_idxs[1];
-//       tree->children[1] = tree_idxs[2];
-//       tree->cost = cost;
-//     } else if(tree_idxs[1] != 0) {
-//       ret_tree_idx = tree_idxs[1];
-//       ChangeSetTree *tree = change_set_tree_array_get(&ctx->change_set_trees, ret_tree_idx);
-//       tree->children[0] = tree_idxs[2];
-//       tree->cost = cost;
-//     } else {
-//       ret_tree_idx = tree_idxs[2];
-//       ChangeSetTree *tree = change_set_tree_array_get(&ctx->change_set_trees, ret_tree_idx);
-//       tree->cost = cost;
-//     }
-//     // fprintf(stderr, "BASE COST: %lld\n", cost);
-//   } else {
-
-//     assert(best_sub_length <= len_old);
-//     assert(best_sub_length <= len_new);
-
-//     uint64_t best_cost = UINT64_MAX;
-//     // fprintf(stderr, "----------------- %d %d\n", better_matches.len, best_sub_length);
-//     for(uint32_t i = 0; i < better_matches.len; i++) {
-//       BetterMatch *better_match = &better_matches.data[i];
-//       uint32_t sub_length = better_match->sub_len;
-//       bool is_best = sub_length == best_sub_length;
-//       // fprintf(stderr, "%d MATCH WITH %d (%d) (%d)\n", i, better_match->sub_len, is_best, best_sub_length);
-//       if(is_best) {
-
-//         uint32_t sub_start_old = better_match->sub_start_old;
-//         uint32_t sub_start_new = better_match->sub_start_new;
-
-//         uint32_t left_start_old = start_old;
-//         uint32_t left_len_old = sub_start_old - start_old;
-//         uint32_t left_start_new = start_new;
-//         uint32_t left_len_new = sub_start_new - start_new;
-
-//         uint32_t right_start_old = sub_start_old + sub_length;
-//         uint32_t right_len_old = (start_old + len_old) - (sub_start_old + sub_length);
-//         uint32_t right_start_new = sub_start_new + sub_length;
-//         uint32_t right_len_new = (start_new + len_new) - (sub_start_new + sub_length);
-
-//         assert(left_start_old >= start_old);
-//         assert(left_start_old + left_len_old < right_start_old);
-//         assert(right_len_old <= len_old);
-
-//         assert(left_start_new >= start_new);
-//         assert(left_start_new + left_len_new < right_start_new);
-//         assert(right_len_new <= len_new);
-
-//         assert(right_len_new + left_len_new < len_new || right_len_old + right_len_old < len_old);
-
-//         fprintf(stderr, "%ld\n", right_len_new + left_len_new + right_len_old + right_len_old);
-
-//         fprintf(stderr, "N%u_%u__%u_%u -> N%u_%u__%u_%u;\n", start_old, len_old, start_new, len_new,  
-//                                                              left_start_old, left_len_old, left_start_new, left_len_new);
-
-//         // raise(SIGTRAP);
-
-//         uint32_t left_idx = token_diff(ctx, left_start_old, left_len_old, left_start_new, left_len_new);
-
-//         if(ctx->output_eq) {
-
-
-//           // output_change_set(ctx, CHANGE_TYPE_EQL,
-//           //                   sub_start_old, sub_length,
-//           //                   sub_start_new, sub_length);
-
-//           // rb_ary_push(rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_EQL, rb_input_old, rb_input_new,
-//           //                                                tokens_old, sub_start_old, sub_length,
-//           //                                                tokens_new, sub_start_new, sub_length));
-//         }
-
-
-//         fprintf(stderr, "N%u_%u__%u_%u -> N%u_%u__%u_%u;\n", start_old, len_old, start_new, len_new,
-//                                                              right_start_old, right_len_old, right_start_new, right_len_new);
-
-//         uint32_t right_idx = token_diff(ctx, right_start_old, right_len_old, right_start_new, right_len_new);
-
-//         uint64_t cost = ctx->change_set_trees.data[left_idx].cost + ctx->change_set_trees.data[right_idx].cost;
-
-//         if(cost < best_cost) {
-//           ret_tree_idx = change_set_tree_array_push(&ctx->change_set_trees);
-//           ChangeSetTree *tree = change_set_tree_array_get(&ctx->change_set_trees, ret_tree_idx);
-
-//           tree->change_type = CHANGE_TYPE_EQL;
-//           tree->cost = cost;
-//           tree->start_old = sub_start_old;
-//           tree->len_old = best_sub_length;
-//           tree->start_new = sub_start_new;
-//           tree->len_new = best_sub_length;
-//           tree->children[0] = left_idx;
-//           tree->children[1] = right_idx;
-
-//           best_cost = cost;
-//           // fprintf(stderr, "BEST COST: %lld\n", best_cost);
-//         }
-//       }
-//     }
-//     better_match_array_destroy(&better_matches);
-//   }
-
-//   assert(ret_tree_idx != 0);
-//   return ret_tree_idx;
-// }
-
 static void
 rb_change_set_get(ChangeSet *change_set, long index, VALUE *rb_old_token, VALUE *rb_new_token) {
   *rb_old_token = Qnil;
@@ -1489,175 +1133,1023 @@ rb_change_set_type(VALUE self) {
   return ID2SYM(type_id);
 }
 
-static VALUE
-rb_ts_diff_diff_s(VALUE self, VALUE rb_old, VALUE rb_new,
-                  VALUE rb_output_eq, VALUE rb_output_replace, VALUE rb_ignore_whitespace, VALUE rb_ignore_comments) {
+static void
+diff_context_stats_init(DiffContext *ctx, VALUE rb_stats) {
+  if(!RB_TEST(rb_stats)) {
+    ctx->engine.stats = NULL;
+    return;
+  }
 
-  // FIXME: check node
-  // Check_Type(rb_old, T_STRING);
-  // Check_Type(rb_new, T_STRING);
+  memset(&ctx->stats, 0, sizeof(DiffStats));
+  ctx->tokenize_ns = 0;
+  ctx->search_ns = 0;
+  ctx->output_ns = 0;
+  ctx->engine.stats = &ctx->stats;
+}
 
-  DiffContext ctx;
+// Nanoseconds for the phase timings, 0 unless stats are kept
+static inline uint64_t
+diff_context_clock(DiffContext *ctx) {
+  if(ctx->engine.stats == NULL) return 0;
 
-  ctx.output_eq = RB_TEST(rb_output_eq);
-  ctx.output_replace = RB_TEST(rb_output_replace);
-  ctx.split_lines = false; //RB_TEST(rb_split_lines);
-  bool ignore_whitespace = RB_TEST(rb_ignore_whitespace);
-  bool ignore_comments = RB_TEST(rb_ignore_comments);
-  VALUE rb_out_ary;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+/* Hands the stats of the diff to TreeSitter::Diff.last_stats, which keeps
+   them per fiber. Call before the workspace and the context are destroyed,
+   their capacities make up the scratch memory */
+static void
+diff_context_store_stats(DiffContext *ctx, bool prepared) {
+  if(ctx->engine.stats == NULL) return;
+
+  size_t scratch_bytes = 0;
+  if(prepared) {
+    DiffWorkspace *ws = ctx->engine.ws;
+    scratch_bytes = ws->v_scratch_capa * sizeof(int64_t) +
+                    ws->path_array.capa * sizeof(Path) +
+                    ws->path_frames.capa * sizeof(PathFrame) +
+                    ws->id_tables_capa * 4 * sizeof(uint32_t) +
+                    ws->histogram_chain_capa * sizeof(uint32_t) +
+                    ctx->engine.edit_script.capa * sizeof(EditOp);
+  }
+
+  VALUE rb_stats = rb_hash_new();
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("tokens_old")), SIZET2NUM(prepared ? ctx->tokens_old.len : 0));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("tokens_new")), SIZET2NUM(prepared ? ctx->tokens_new.len : 0));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("prefix_len")), SSIZET2NUM(prepared ? ctx->engine.prefix_len : 0));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("suffix_len")), SSIZET2NUM(prepared ? ctx->engine.suffix_len : 0));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("distance")), ULL2NUM(ctx->stats.distance));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("boxes")), ULL2NUM(ctx->stats.boxes));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("max_d")), LL2NUM(ctx->stats.max_d));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("max_path_len")), UINT2NUM(ctx->stats.max_path_len));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("scratch_bytes")), SIZET2NUM(scratch_bytes));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("tokenize_ns")), ULL2NUM(ctx->tokenize_ns));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("search_ns")), ULL2NUM(ctx->search_ns));
+  rb_hash_aset(rb_stats, ID2SYM(rb_intern("output_ns")), ULL2NUM(ctx->output_ns));
+
+  rb_thread_local_aset(rb_thread_current(), id_last_stats, rb_stats);
+}
+
+/* The TokenizedTree given in place of a node, if any. Its tokens are
+   only usable by diffs that would have tokenized the node the same way */
+static TokenizedTree *
+tokenized_tree_from_value(VALUE rb_value, bool ignore_whitespace, bool ignore_comments) {
+  if(!rb_typeddata_is_kind_of(rb_value, &tokenized_tree_type)) {
+    return NULL;
+  }
+
+  TokenizedTree *tokenized = RTYPEDDATA_DATA(rb_value);
+  if(tokenized->ignore_whitespace != ignore_whitespace || tokenized->ignore_comments != ignore_comments) {
+    rb_raise(rb_eArgError, "tree was tokenized with ignore_whitespace: %s, ignore_comments: %s",
+             tokenized->ignore_whitespace ? "true" : "false", tokenized->ignore_comments ? "true" : "false");
+  }
+  return tokenized;
+}
 
+/* Reads and tokenizes both inputs. Returns false if the inputs are
+   identical, in which case nothing has been allocated. Whatever was
+   allocated before a raise is freed by diff_context_destroy */
+static bool
+diff_context_prepare(DiffContext *ctx, VALUE rb_old, VALUE rb_new, bool ignore_whitespace, bool ignore_comments) {
   uint32_t input_old_start;
   uint32_t input_new_start;
   uint32_t input_old_len;
   uint32_t input_new_len;
 
-  ctx.input_old = rb_node_input_(rb_old, &input_old_start, &input_old_len);
-  ctx.input_new = rb_node_input_(rb_new, &input_new_start, &input_new_len);
-  ctx.rb_new = rb_new;
-  ctx.rb_old = rb_old;
-
-  rb_out_ary = rb_ary_new();
+  ctx->rb_arena = Qnil;
+  ctx->rb_tokenized_old = Qnil;
+  ctx->rb_tokenized_new = Qnil;
+  ctx->tokens_old.data = NULL;
+  ctx->tokens_new.data = NULL;
+  ctx->engine.ids_old = NULL;
+  ctx->engine.ids_new = NULL;
+  ctx->engine.edit_script.data = NULL;
+
+  TokenizedTree *tokenized_old = tokenized_tree_from_value(rb_old, ignore_whitespace, ignore_comments);
+  TokenizedTree *tokenized_new = tokenized_tree_from_value(rb_new, ignore_whitespace, ignore_comments);
+  ctx->rb_tokenized_old = tokenized_old != NULL ? rb_old : Qnil;
+  ctx->rb_tokenized_new = tokenized_new != NULL ? rb_new : Qnil;
+
+  if(tokenized_old != NULL) {
+    rb_old = tokenized_old->rb_node;
+    ctx->input_old = tokenized_old->input;
+    input_old_start = tokenized_old->input_start;
+    input_old_len = tokenized_old->input_len;
+  } else {
+    ctx->input_old = rb_node_input_(rb_old, &input_old_start, &input_old_len);
+  }
 
-  if(input_old_len == input_new_len && !memcmp(ctx.input_old + input_old_start, ctx.input_new + input_new_start, input_new_len)) {
-    return rb_out_ary;
+  if(tokenized_new != NULL) {
+    rb_new = tokenized_new->rb_node;
+    ctx->input_new = tokenized_new->input;
+    input_new_start = tokenized_new->input_start;
+    input_new_len = tokenized_new->input_len;
+  } else {
+    ctx->input_new = rb_node_input_(rb_new, &input_new_start, &input_new_len);
   }
 
-  ctx.rb_out_ary = rb_out_ary;
-  ctx.tokens_old = rb_node_tokenize_(rb_old, ignore_whitespace, ignore_comments);
-  ctx.tokens_new = rb_node_tokenize_(rb_new, ignore_whitespace, ignore_comments);
+  ctx->rb_new = rb_new;
+  ctx->rb_old = rb_old;
 
-  RB_GC_GUARD(rb_old);
-  RB_GC_GUARD(rb_new);
+  if(input_old_len == input_new_len && !memcmp(ctx->input_old + input_old_start, ctx->input_new + input_new_start, input_new_len)) {
+    return false;
+  }
+
+  if(tokenized_old != NULL) {
+    ctx->tokens_old = tokenized_old->tokens;
+    ctx->hashes_old = tokenized_old->hashes;
+  } else {
+    ctx->tokens_old = rb_node_tokenize_(rb_old, ignore_whitespace, ignore_comments);
+    ctx->hashes_old = NULL;
+  }
 
-  ssize_t tokens_old_len = (ssize_t) ctx.tokens_old.len;
-  ssize_t tokens_new_len = (ssize_t) ctx.tokens_new.len;
+  if(tokenized_new != NULL) {
+    ctx->tokens_new = tokenized_new->tokens;
+    ctx->hashes_new = tokenized_new->hashes;
+  } else {
+    ctx->tokens_new = rb_node_tokenize_(rb_new, ignore_whitespace, ignore_comments);
+    ctx->hashes_new = NULL;
+  }
+  ctx->input_old_start = input_old_start;
+  ctx->input_new_start = input_new_start;
+  ctx->input_old_end = input_old_start + input_old_len;
+  ctx->input_new_end = input_new_start + input_new_len;
+
+  edit_script_init(&ctx->engine.edit_script, 128);
+  ctx->engine.ids_old = RB_ALLOC_N(TokenId, ctx->tokens_old.len);
+  ctx->engine.ids_new = RB_ALLOC_N(TokenId, ctx->tokens_new.len);
+  ctx->engine.old_len = ctx->tokens_old.len;
+  ctx->engine.new_len = ctx->tokens_new.len;
+  ctx->finished = false;
+
+  return true;
+}
 
-  // ctx.table_entries_old = RB_ALLOC_N(IndexKey, tokens_old_len);
+static void
+diff_context_destroy(DiffContext *ctx) {
+  edit_script_destroy(&ctx->engine.edit_script);
+  xfree(ctx->engine.ids_old);
+  xfree(ctx->engine.ids_new);
+  xfree(ctx->edit_windows);
+  if(NIL_P(ctx->rb_arena)) {
+    if(NIL_P(ctx->rb_tokenized_old)) xfree(ctx->tokens_old.data);
+    if(NIL_P(ctx->rb_tokenized_new)) xfree(ctx->tokens_new.data);
+  }
+}
 
-  // ctx.index_list.capa = ctx.tokens_old.len;
-  // ctx.index_list.len = 0;
-  // ctx.index_list.entries = RB_ALLOC_N(st_data_t, ctx.index_list.capa);
+// Interns the tokens and strips the common prefix and suffix, returns false if nothing is left
+static bool
+trim_tokens(DiffContext *ctx) {
+  intern_tokens(ctx);
 
-  // for(size_t i = 0; i < tokens_new_len; i++) {
-  //   Token *token = &tokens_new[i];
-  //   fprintf(stderr, "TOKEN OLD: %.*s\n", token->end_byte - token->start_byte, input_new + token->start_byte);
-  //   if(token->before_newline) {
-  //     fprintf(stderr, "BEFORE NEWLINE\n");
-  //   }
-  // }
+  if(!diff_engine_trim(&ctx->engine)) {
+    return false;
+  }
 
+  ctx->tokens_new_ = ctx->tokens_new.data + ctx->engine.prefix_len;
+  ctx->tokens_old_ = ctx->tokens_old.data + ctx->engine.prefix_len;
+  return true;
+}
 
-  // match_map_init(&ctx.match_map, ctx.tokens_old.len);
-  // match_map_init(&ctx.next_match_map, ctx.tokens_old.len);
-  // change_set_tree_array_init(&ctx.change_set_trees, 512);
-  // ctx.old_index_map = st_init_table(&type_index_key_hash);
+/* Runs without the GVL, in diff_many on threads that are not Ruby's. So
+   it must neither touch Ruby objects nor raise, and allocates with
+   ENGINE_ALLOC_N rather than xmalloc, which may collect garbage */
+static void *
+diff_tokens_nogvl(void *arg) {
+  DiffContext *ctx = (DiffContext *) arg;
+  ssize_t tokens_old_len = (ssize_t) ctx->tokens_old.len;
+  ssize_t tokens_new_len = (ssize_t) ctx->tokens_new.len;
+  uint64_t start = diff_context_clock(ctx);
+
+  ctx->engine.edit_script.len = 0;
+
+  if(ctx->edit_windows_len > 0 ? trim_edits(ctx) : trim_tokens(ctx)) {
+    ssize_t prefix_len = ctx->engine.prefix_len;
+    ssize_t suffix_len = ctx->engine.suffix_len;
+    if(ctx->edit_windows_len > 0) {
+      walk_edits(ctx, 0, tokens_old_len - suffix_len - prefix_len,
+                      0, tokens_new_len - suffix_len - prefix_len);
+    } else if(ctx->anchor_min_len > 0) {
+      walk_subtrees(ctx, 0, tokens_old_len - suffix_len - prefix_len,
+                         0, tokens_new_len - suffix_len - prefix_len);
+    } else if(ctx->split_lines) {
+      walk_lines(ctx, 0, tokens_old_len - suffix_len - prefix_len,
+                      0, tokens_new_len - suffix_len - prefix_len);
+    } else if(ctx->lazy && ctx->engine.algorithm == DIFF_ALGORITHM_MYERS) {
+      diff_engine_find_path_init(&ctx->engine, 0, 0, tokens_old_len - suffix_len - prefix_len,
+                                                  tokens_new_len - suffix_len - prefix_len);
+    } else {
+      diff_engine_walk(&ctx->engine, 0, tokens_old_len - suffix_len - prefix_len,
+                                     0, tokens_new_len - suffix_len - prefix_len);
+    }
+  }
 
-  path_array_init(&ctx.path_array, 512);
-  tmp_token_array_init(&ctx.tmp_tokens_new, 128);
-  tmp_token_array_init(&ctx.tmp_tokens_old, 128);
+  ctx->search_ns += diff_context_clock(ctx) - start;
+  ctx->finished = !ctx->engine.interrupted;
+  return NULL;
+}
 
-  ssize_t prefix_len = 0;
-  ssize_t tokens_min_len = MIN(ctx.tokens_old.len, ctx.tokens_new.len);
-  for(ssize_t i = 0; i < tokens_min_len; i++) {
-    Token *old_token = &ctx.tokens_old.data[i];
-    Token *new_token = &ctx.tokens_new.data[i];
+#define LAZY_PATH_CHUNK 256
 
-    assert(old_token->end_byte <= input_old_start + input_old_len);
-    assert(new_token->end_byte <= input_new_start + input_new_len);
+// Resumes a lazy Myers search for the next LAZY_PATH_CHUNK points of the path
+static void *
+diff_tokens_step_nogvl(void *arg) {
+  DiffContext *ctx = (DiffContext *) arg;
+  PathArray *path_array = &ctx->engine.ws->path_array;
+  uint64_t start = diff_context_clock(ctx);
 
-    if(!token_eql(old_token, ctx.input_old, new_token, ctx.input_new)) break;
+  diff_engine_find_path_step(&ctx->engine, path_array->len + LAZY_PATH_CHUNK);
+  ctx->search_ns += diff_context_clock(ctx) - start;
+  if(ctx->engine.interrupted) return NULL;
 
+  diff_engine_walk_path(&ctx->engine);
+  ctx->finished = true;
+  return NULL;
+}
 
-    //if(old_token->before_newline && new_token->before_newline) {
-      prefix_len = MIN(tokens_min_len, i + 1);
-    //}
-  }
+static void *
+distance_nogvl(void *arg) {
+  DiffContext *ctx = (DiffContext *) arg;
+  uint64_t start = diff_context_clock(ctx);
 
-  if(prefix_len == tokens_old_len && prefix_len == tokens_new_len) {
-    goto done;
+  ctx->distance = 0;
+  if(trim_tokens(ctx)) {
+    ctx->distance = diff_engine_distance(&ctx->engine, ctx->max_distance);
   }
+  ctx->search_ns += diff_context_clock(ctx) - start;
 
+  ctx->finished = !ctx->engine.interrupted;
+  return NULL;
+}
 
-  ssize_t suffix_len = 0;
-  for(ssize_t i = 0; tokens_old_len - i > prefix_len && tokens_new_len - i > prefix_len; i++) {
-    // assert(tokens_old[i - 1].end_byte <= input_old_len);
-    // assert(tokens_new[i - 1].end_byte <= input_new_len);
-    Token *old_token = &ctx.tokens_old.data[tokens_old_len - i - 1];
-    Token *new_token = &ctx.tokens_new.data[tokens_new_len - i - 1];
+static void
+diff_tokens_ubf(void *arg) {
+  DiffContext *ctx = (DiffContext *) arg;
+  ctx->engine.interrupted = true;
+}
 
-    //if(old_token->before_newline && new_token->before_newline) {
-      suffix_len = i;
-    //}
+static VALUE
+check_ints(VALUE arg) {
+  rb_thread_check_ints();
+  return Qnil;
+}
 
-    if(!token_eql(old_token, ctx.input_old, new_token, ctx.input_new)) break;
+/* Runs func with the GVL released, restarting it after interrupts
+   that did not raise. Returns the tag of a pending exception, if any */
+static int
+diff_call_without_gvl(DiffContext *ctx, void *(*func)(void *)) {
+  while(true) {
+    ctx->engine.interrupted = false;
+    ctx->finished = false;
+    rb_thread_call_without_gvl2(func, ctx, diff_tokens_ubf, ctx);
+    if(ctx->finished) return 0;
+
+    int state = 0;
+    rb_protect(check_ints, Qnil, &state);
+    if(state) return state;
+  }
+}
+
+/* Computes the edit script with the GVL released. On an interrupt the
+   context is torn down before a pending exception propagates,
+   otherwise the diff is restarted */
+static void
+diff_tokens(DiffContext *ctx) {
+  int state = diff_call_without_gvl(ctx, diff_tokens_nogvl);
+  if(state) {
+    diff_context_destroy(ctx);
+    rb_jump_tag(state);
+  }
+}
 
+// Yields the change sets completed so far when streaming them
+static void
+diff_context_flush(DiffContext *ctx) {
+  if(!ctx->lazy) return;
+
+  for(long i = 0; i < RARRAY_LEN(ctx->rb_out_ary); i++) {
+    rb_yield(RARRAY_AREF(ctx->rb_out_ary, i));
   }
+  rb_ary_clear(ctx->rb_out_ary);
+}
 
-  // suffix_len = 0;
-  // prefix_len = 0;
+static void diff_context_output_(DiffContext *ctx);
+
+/* Turns the edit script into change sets, appended to ctx->rb_out_ary.
+   Lazy contexts instead yield them as soon as they are complete, the time
+   spent in the block then counts towards output_ns */
+static void
+diff_context_output(DiffContext *ctx) {
+  uint64_t start = diff_context_clock(ctx);
+  uint64_t search_ns = ctx->search_ns;
+
+  diff_context_output_(ctx);
+
+  // minus the chunks of a lazy search run in between
+  ctx->output_ns += diff_context_clock(ctx) - start - (ctx->search_ns - search_ns);
+}
+
+static void
+diff_context_output_(DiffContext *ctx) {
+  ssize_t tokens_old_len = (ssize_t) ctx->tokens_old.len;
+  ssize_t tokens_new_len = (ssize_t) ctx->tokens_new.len;
+  ssize_t prefix_len = ctx->engine.prefix_len;
+  ssize_t suffix_len = ctx->engine.suffix_len;
+
+  if(prefix_len == tokens_old_len && prefix_len == tokens_new_len) {
+    return;
+  }
 
   assert(suffix_len + prefix_len <= tokens_old_len);
   assert(suffix_len + prefix_len <= tokens_new_len);
 
-  if(suffix_len + prefix_len >= MAX(tokens_old_len, tokens_new_len)) {
-    rb_p(rb_new);
-    rb_p(rb_old);
-    fprintf(stderr, "%d\n", rb_eql(rb_new, rb_old));
+  assert(suffix_len + prefix_len < MAX(tokens_old_len, tokens_new_len));
+
+  // byte ranges are copied out, so the tokens can stay with the context
+  VALUE rb_arena = NIL_P(ctx->rb_out_str) ? token_arena_new(ctx) : Qnil;
+
+  if(ctx->output_eq && prefix_len > 0) {
+    push_change_set(ctx, CHANGE_TYPE_EQL, 0, prefix_len, 0, prefix_len);
   }
 
-  assert(suffix_len + prefix_len < MAX(tokens_old_len, tokens_new_len));
+  ctx->tmp_tokens_old.end = (uint32_t) prefix_len;
+  ctx->tmp_tokens_new.end = (uint32_t) prefix_len;
+
+  if(!ctx->lazy) {
+    replay_edit_script(ctx);
+  } else {
+    ctx->cb = collect_change_sets;
+    ctx->cb(ctx, CALLBACK_START, NULL, NULL);
+    replay_edit_ops(ctx);
+    diff_context_flush(ctx);
+
+    // whatever is left of a lazy Myers search runs chunk by chunk, as change sets are consumed
+    while(ctx->engine.ws->path_frames.len > 0) {
+      ctx->engine.edit_script.len = 0;
+      int state = diff_call_without_gvl(ctx, diff_tokens_step_nogvl);
+      if(state) rb_jump_tag(state);
+      replay_edit_ops(ctx);
+      diff_context_flush(ctx);
+    }
+
+    ctx->cb = collect_change_sets;
+    ctx->cb(ctx, CALLBACK_FINISH, NULL, NULL);
+  }
+
+  if(ctx->output_eq && suffix_len > 0) {
+    push_change_set(ctx, CHANGE_TYPE_EQL, ctx->tokens_old.len - suffix_len, suffix_len,
+                    ctx->tokens_new.len - suffix_len, suffix_len);
+  }
+
+  diff_context_flush(ctx);
+  RB_GC_GUARD(rb_arena);
+}
+
+static DiffAlgorithm
+diff_algorithm_from_sym(VALUE rb_algorithm) {
+  Check_Type(rb_algorithm, T_SYMBOL);
+  ID algorithm_id = SYM2ID(rb_algorithm);
+
+  if(algorithm_id == id_myers) {
+    return DIFF_ALGORITHM_MYERS;
+  } else if(algorithm_id == id_patience) {
+    return DIFF_ALGORITHM_PATIENCE;
+  } else if(algorithm_id == id_histogram) {
+    return DIFF_ALGORITHM_HISTOGRAM;
+  } else {
+    rb_raise(rb_eArgError, "unknown diff algorithm %"PRIsVALUE, rb_algorithm);
+  }
+}
+
+static int64_t
+max_cost_from_value(VALUE rb_max_cost) {
+  if(NIL_P(rb_max_cost)) {
+    return INT64_MAX;
+  }
+
+  int64_t max_cost = NUM2LL(rb_max_cost);
+  if(max_cost < 1) {
+    rb_raise(rb_eArgError, "max_cost must be positive");
+  }
+  return max_cost;
+}
+
+// false disables anchoring, true uses the default minimum subtree size
+static uint32_t
+anchor_min_len_from_value(VALUE rb_anchor_subtrees) {
+  if(!RB_TEST(rb_anchor_subtrees)) {
+    return 0;
+  }
+
+  if(rb_anchor_subtrees == Qtrue) {
+    return SUBTREE_ANCHOR_MIN_LEN;
+  }
+
+  uint32_t min_len = NUM2UINT(rb_anchor_subtrees);
+  if(min_len < 1) {
+    rb_raise(rb_eArgError, "anchor_subtrees must be positive");
+  }
+  return min_len;
+}
+
+// Checks edits of [start_byte, old_end_byte, new_end_byte], returns how many there are
+static long
+edit_windows_check(VALUE rb_edits) {
+  if(NIL_P(rb_edits)) {
+    return 0;
+  }
+
+  Check_Type(rb_edits, T_ARRAY);
+  long edits_len = RARRAY_LEN(rb_edits);
+
+  for(long i = 0; i < edits_len; i++) {
+    VALUE rb_edit = RARRAY_AREF(rb_edits, i);
+    Check_Type(rb_edit, T_ARRAY);
+    if(RARRAY_LEN(rb_edit) != 3) {
+      rb_raise(rb_eArgError, "expected edits of [start_byte, old_end_byte, new_end_byte], got an array of size %ld", RARRAY_LEN(rb_edit));
+    }
+    uint32_t start = NUM2UINT(RARRAY_AREF(rb_edit, 0));
+    if(NUM2UINT(RARRAY_AREF(rb_edit, 1)) < start || NUM2UINT(RARRAY_AREF(rb_edit, 2)) < start) {
+      rb_raise(rb_eArgError, "edit ends before it starts");
+    }
+  }
+  return edits_len;
+}
+
+/* Folds edits that passed edit_windows_check, in the order they were
+   applied to the tree (as for Tree#edit), into disjoint windows of old
+   bytes [left, right) and new bytes [top, bottom), ordered on both sides */
+static uint32_t
+edit_windows_from_value(VALUE rb_edits, Box **out_windows) {
+  *out_windows = NULL;
+  long edits_len = NIL_P(rb_edits) ? 0 : RARRAY_LEN(rb_edits);
+  if(edits_len <= 0) {
+    return 0;
+  }
+
+  Box *windows = RB_ALLOC_N(Box, edits_len);
+  uint32_t windows_len = 0;
+
+  for(long i = 0; i < edits_len; i++) {
+    VALUE rb_edit = RARRAY_AREF(rb_edits, i);
+    int64_t start = NUM2UINT(RARRAY_AREF(rb_edit, 0));
+    int64_t old_end = NUM2UINT(RARRAY_AREF(rb_edit, 1));
+    int64_t new_end = NUM2UINT(RARRAY_AREF(rb_edit, 2));
+
+    // the edit is in the coordinates of the tree as edited so far, the new side of the windows
+    uint32_t first = 0;
+    int64_t shift = 0;
+    while(first < windows_len && windows[first].bottom < start) {
+      shift += BOX_HEIGHT((&windows[first])) - BOX_WIDTH((&windows[first]));
+      first++;
+    }
+
+    uint32_t last = first;
+    int64_t end_shift = shift;
+    while(last < windows_len && windows[last].top <= old_end) {
+      end_shift += BOX_HEIGHT((&windows[last])) - BOX_WIDTH((&windows[last]));
+      last++;
+    }
+
+    Box merged;
+    int64_t merged_end;
+
+    if(first < last && windows[first].top <= start) {
+      merged.left = windows[first].left;
+      merged.top = windows[first].top;
+    } else {
+      merged.left = start - shift;
+      merged.top = start;
+    }
+
+    if(first < last && windows[last - 1].bottom >= old_end) {
+      merged.right = windows[last - 1].right;
+      merged_end = windows[last - 1].bottom;
+    } else {
+      merged.right = old_end - end_shift;
+      merged_end = old_end;
+    }
+
+    int64_t delta = new_end - old_end;
+    merged.bottom = merged_end + delta;
+
+    for(uint32_t j = last; j < windows_len; j++) {
+      windows[j].top += delta;
+      windows[j].bottom += delta;
+    }
+
+    memmove(windows + first + 1, windows + last, (windows_len - last) * sizeof(Box));
+    windows[first] = merged;
+    windows_len = windows_len - (last - first) + 1;
+  }
+
+  *out_windows = windows;
+  return windows_len;
+}
+
+// Each of edits, anchor_subtrees and split_lines splits up the search its own way, only one can
+static void
+diff_context_check_strategy(DiffContext *ctx, long edits_len) {
+  if(edits_len > 0 && (ctx->anchor_min_len > 0 || ctx->split_lines)) {
+    rb_raise(rb_eArgError, "edits cannot be combined with anchor_subtrees or split_lines");
+  }
+  if(ctx->anchor_min_len > 0 && ctx->split_lines) {
+    rb_raise(rb_eArgError, "anchor_subtrees cannot be combined with split_lines");
+  }
+}
+
+/* Options shared by diff and each_change. Edits are only checked here,
+   their windows are built once the context is prepared */
+static void
+diff_context_configure(DiffContext *ctx, VALUE rb_output_eq, VALUE rb_output_replace, VALUE rb_algorithm,
+                       VALUE rb_max_cost, VALUE rb_anchor_subtrees, VALUE rb_edits, VALUE rb_split_lines) {
+  ctx->output_eq = RB_TEST(rb_output_eq);
+  ctx->output_replace = RB_TEST(rb_output_replace);
+  ctx->split_lines = RB_TEST(rb_split_lines);
+  ctx->engine.algorithm = diff_algorithm_from_sym(rb_algorithm);
+  ctx->engine.max_cost = max_cost_from_value(rb_max_cost);
+  ctx->anchor_min_len = anchor_min_len_from_value(rb_anchor_subtrees);
+  ctx->rb_out_ary = rb_ary_new();
+  ctx->rb_out_str = Qnil;
+  ctx->edit_windows = NULL;
+  ctx->edit_windows_len = 0;
+
+  diff_context_check_strategy(ctx, edit_windows_check(rb_edits));
+}
+
+static VALUE
+rb_ts_diff_diff_s(VALUE self, VALUE rb_old, VALUE rb_new,
+                  VALUE rb_output_eq, VALUE rb_output_replace, VALUE rb_ignore_whitespace, VALUE rb_ignore_comments,
+                  VALUE rb_algorithm, VALUE rb_max_cost, VALUE rb_anchor_subtrees, VALUE rb_edits, VALUE rb_split_lines,
+                  VALUE rb_stats) {
+
+  // FIXME: check node
+  // Check_Type(rb_old, T_STRING);
+  // Check_Type(rb_new, T_STRING);
+
+  DiffContext ctx;
+  DiffWorkspace ws;
+
+  diff_context_configure(&ctx, rb_output_eq, rb_output_replace, rb_algorithm, rb_max_cost, rb_anchor_subtrees, rb_edits, rb_split_lines);
+  ctx.lazy = false;
+  bool ignore_whitespace = RB_TEST(rb_ignore_whitespace);
+  bool ignore_comments = RB_TEST(rb_ignore_comments);
+  diff_context_stats_init(&ctx, rb_stats);
+
+  uint64_t start = diff_context_clock(&ctx);
+  bool prepared = diff_context_prepare(&ctx, rb_old, rb_new, ignore_whitespace, ignore_comments);
+  ctx.tokenize_ns = diff_context_clock(&ctx) - start;
+  if(!prepared) {
+    diff_context_store_stats(&ctx, false);
+    return ctx.rb_out_ary;
+  }
+  ctx.edit_windows_len = edit_windows_from_value(rb_edits, &ctx.edit_windows);
+
+  diff_workspace_init(&ws);
+  ctx.engine.ws = &ws;
+  diff_tokens(&ctx);
+
+  diff_context_output(&ctx);
+  diff_context_store_stats(&ctx, true);
+  diff_workspace_destroy(&ws);
+  diff_context_destroy(&ctx);
+
+  RB_GC_GUARD(rb_old);
+  RB_GC_GUARD(rb_new);
 
-  //  token_diff2(&ctx,
-  //                                prefix_len, ctx.tokens_old.len - suffix_len - prefix_len,
-  //                                prefix_len, ctx.tokens_new.len - suffix_len - prefix_len);
+  return ctx.rb_out_ary;
+}
+
+/* Like diff, but returns the byte ranges of the change sets packed as
+   records of five native-endian uint32, see push_change_set. No tokens
+   or change sets are handed out, so none are allocated as objects */
+static VALUE
+rb_ts_diff_diff_ranges_s(VALUE self, VALUE rb_old, VALUE rb_new,
+                         VALUE rb_output_eq, VALUE rb_output_replace, VALUE rb_ignore_whitespace, VALUE rb_ignore_comments,
+                         VALUE rb_algorithm, VALUE rb_max_cost, VALUE rb_anchor_subtrees, VALUE rb_edits, VALUE rb_split_lines,
+                         VALUE rb_stats) {
+  DiffContext ctx;
+  DiffWorkspace ws;
+
+  diff_context_configure(&ctx, rb_output_eq, rb_output_replace, rb_algorithm, rb_max_cost, rb_anchor_subtrees, rb_edits, rb_split_lines);
+  ctx.lazy = false;
+  ctx.rb_out_str = rb_str_buf_new(0);
+  bool ignore_whitespace = RB_TEST(rb_ignore_whitespace);
+  bool ignore_comments = RB_TEST(rb_ignore_comments);
+  diff_context_stats_init(&ctx, rb_stats);
+
+  uint64_t start = diff_context_clock(&ctx);
+  bool prepared = diff_context_prepare(&ctx, rb_old, rb_new, ignore_whitespace, ignore_comments);
+  ctx.tokenize_ns = diff_context_clock(&ctx) - start;
+  if(!prepared) {
+    diff_context_store_stats(&ctx, false);
+    return ctx.rb_out_str;
+  }
+  ctx.edit_windows_len = edit_windows_from_value(rb_edits, &ctx.edit_windows);
+
+  diff_workspace_init(&ws);
+  ctx.engine.ws = &ws;
+  diff_tokens(&ctx);
+
+  diff_context_output(&ctx);
+  diff_context_store_stats(&ctx, true);
+  diff_workspace_destroy(&ws);
+  diff_context_destroy(&ctx);
+
+  RB_GC_GUARD(rb_old);
+  RB_GC_GUARD(rb_new);
+
+  return ctx.rb_out_str;
+}
+
+static VALUE
+each_change_run(VALUE arg) {
+  DiffContext *ctx = (DiffContext *) arg;
+
+  int state = diff_call_without_gvl(ctx, diff_tokens_nogvl);
+  if(state) rb_jump_tag(state);
+
+  diff_context_output(ctx);
+  diff_context_store_stats(ctx, true);
+  return Qnil;
+}
+
+static VALUE
+each_change_ensure(VALUE arg) {
+  DiffContext *ctx = (DiffContext *) arg;
+  diff_workspace_destroy(ctx->engine.ws);
+  diff_context_destroy(ctx);
+  return Qnil;
+}
+
+/* Like diff, but yields the change sets as they are found. A plain Myers
+   diff is computed in chunks between yields, so that breaking out early
+   also skips the search for the rest of the input */
+static VALUE
+rb_ts_diff_each_change_s(VALUE self, VALUE rb_old, VALUE rb_new,
+                         VALUE rb_output_eq, VALUE rb_output_replace, VALUE rb_ignore_whitespace, VALUE rb_ignore_comments,
+                         VALUE rb_algorithm, VALUE rb_max_cost, VALUE rb_anchor_subtrees, VALUE rb_edits, VALUE rb_split_lines,
+                         VALUE rb_stats) {
+  DiffContext ctx;
+  DiffWorkspace ws;
+
+  rb_need_block();
+
+  diff_context_configure(&ctx, rb_output_eq, rb_output_replace, rb_algorithm, rb_max_cost, rb_anchor_subtrees, rb_edits, rb_split_lines);
+  ctx.lazy = true;
+  bool ignore_whitespace = RB_TEST(rb_ignore_whitespace);
+  bool ignore_comments = RB_TEST(rb_ignore_comments);
+  diff_context_stats_init(&ctx, rb_stats);
+
+  uint64_t start = diff_context_clock(&ctx);
+  bool prepared = diff_context_prepare(&ctx, rb_old, rb_new, ignore_whitespace, ignore_comments);
+  ctx.tokenize_ns = diff_context_clock(&ctx) - start;
+  if(!prepared) {
+    diff_context_store_stats(&ctx, false);
+    return Qnil;
+  }
+  ctx.edit_windows_len = edit_windows_from_value(rb_edits, &ctx.edit_windows);
+
+  diff_workspace_init(&ws);
+  ctx.engine.ws = &ws;
+  rb_ensure(each_change_run, (VALUE) &ctx, each_change_ensure, (VALUE) &ctx);
+
+  RB_GC_GUARD(ctx.rb_out_ary);
+  RB_GC_GUARD(rb_old);
+  RB_GC_GUARD(rb_new);
+
+  return Qnil;
+}
+
+/* The stats of the last diff on this fiber that was run with stats: true,
+   nil if there was none */
+static VALUE
+rb_ts_diff_last_stats_s(VALUE self) {
+  return rb_thread_local_aref(rb_thread_current(), id_last_stats);
+}
+
+/* Number of inserted and deleted tokens, or nil once it exceeds max.
+   Only the frontiers are searched, no path or change sets are built */
+static VALUE
+rb_ts_diff_distance_s(VALUE self, VALUE rb_old, VALUE rb_new, VALUE rb_max,
+                      VALUE rb_ignore_whitespace, VALUE rb_ignore_comments, VALUE rb_stats) {
+  DiffContext ctx;
+  DiffWorkspace ws;
+
+  int64_t max_distance = NIL_P(rb_max) ? INT64_MAX : NUM2LL(rb_max);
+  if(max_distance < 0) {
+    rb_raise(rb_eArgError, "max must not be negative");
+  }
+
+  ctx.max_distance = max_distance;
+  ctx.edit_windows = NULL;
+  ctx.edit_windows_len = 0;
+  diff_context_stats_init(&ctx, rb_stats);
+
+  uint64_t start = diff_context_clock(&ctx);
+  bool prepared = diff_context_prepare(&ctx, rb_old, rb_new, RB_TEST(rb_ignore_whitespace), RB_TEST(rb_ignore_comments));
+  ctx.tokenize_ns = diff_context_clock(&ctx) - start;
+  if(!prepared) {
+    diff_context_store_stats(&ctx, false);
+    return INT2FIX(0);
+  }
+
+  diff_workspace_init(&ws);
+  ctx.engine.ws = &ws;
+  int state = diff_call_without_gvl(&ctx, distance_nogvl);
+  if(!state) {
+    // the search stops at the frontiers, no edits are recorded to count
+    ctx.stats.distance = ctx.distance < 0 ? 0 : (uint64_t) ctx.distance;
+    diff_context_store_stats(&ctx, true);
+  }
+  diff_workspace_destroy(&ws);
+  diff_context_destroy(&ctx);
+  if(state) rb_jump_tag(state);
+
+  RB_GC_GUARD(rb_old);
+  RB_GC_GUARD(rb_new);
 
-  if(ctx.output_eq && prefix_len > 0) {
-      rb_ary_push(ctx.rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_EQL, ctx.rb_old, ctx.rb_new,
-                                                          ctx.tokens_old.data, 0, prefix_len,
-                                                          ctx.tokens_new.data, 0, prefix_len));
+  return ctx.distance < 0 ? Qnil : LL2NUM(ctx.distance);
+}
+
+typedef struct {
+  atomic_size_t next;
+  size_t end;
+} DiffQueue;
+
+typedef struct {
+  DiffContext *contexts;
+  bool *prepared;
+  DiffContext **jobs;
+  DiffQueue *queues;
+  struct DiffWorker *workers;
+  // contexts handed to diff_context_prepare so far, prepared or not
+  size_t contexts_len;
+  size_t jobs_len;
+  size_t workers_len;
+  volatile bool interrupted;
+} DiffPool;
+
+typedef struct DiffWorker {
+  DiffPool *pool;
+  size_t index;
+  DiffWorkspace ws;
+} DiffWorker;
+
+/* Every worker owns a queue of jobs, but takes from the other queues
+   once its own is drained, so large pairs do not stall the batch */
+static DiffContext *
+diff_pool_take(DiffPool *pool, size_t worker_index) {
+  for(size_t i = 0; i < pool->workers_len; i++) {
+    DiffQueue *queue = &pool->queues[(worker_index + i) % pool->workers_len];
+    if(atomic_load(&queue->next) >= queue->end) continue;
+
+    size_t job_index = atomic_fetch_add(&queue->next, 1);
+    if(job_index < queue->end) {
+      return pool->jobs[job_index];
+    }
+  }
+  return NULL;
+}
+
+static void *
+diff_worker_run(void *arg) {
+  DiffWorker *worker = (DiffWorker *) arg;
+  DiffPool *pool = worker->pool;
+  DiffContext *ctx;
+
+  while(!pool->interrupted && (ctx = diff_pool_take(pool, worker->index)) != NULL) {
+    if(ctx->finished) continue;
+    ctx->engine.ws = &worker->ws;
+    diff_tokens_nogvl(ctx);
   }
+  return NULL;
+}
 
-  ctx.tokens_new_ = ctx.tokens_new.data + prefix_len;
-  ctx.tokens_old_ = ctx.tokens_old.data + prefix_len;
-  token_diff2(&ctx, 0, ctx.tokens_old.len - suffix_len - prefix_len ,
-                    0, ctx.tokens_new.len - suffix_len - prefix_len);
+static void *
+diff_pool_run_nogvl(void *arg) {
+  DiffPool *pool = (DiffPool *) arg;
+  pthread_t *threads = ENGINE_ALLOC_N(pthread_t, pool->workers_len);
+  bool *started = ENGINE_ZALLOC_N(bool, pool->workers_len);
 
+  // the calling thread doubles as the first worker. The others are not
+  // Ruby threads, so nothing run by a worker may call into Ruby
+  for(size_t i = 1; i < pool->workers_len; i++) {
+    started[i] = !pthread_create(&threads[i], NULL, diff_worker_run, &pool->workers[i]);
+  }
+  diff_worker_run(&pool->workers[0]);
+
+  for(size_t i = 1; i < pool->workers_len; i++) {
+    if(started[i]) pthread_join(threads[i], NULL);
+  }
+
+  ENGINE_FREE(threads);
+  ENGINE_FREE(started);
+  return NULL;
+}
+
+static void
+diff_pool_ubf(void *arg) {
+  DiffPool *pool = (DiffPool *) arg;
+  pool->interrupted = true;
+  for(size_t i = 0; i < pool->jobs_len; i++) {
+    pool->jobs[i]->engine.interrupted = true;
+  }
+}
+
+static int
+diff_job_cmp(const void *x, const void *y) {
+  const DiffContext *ctx_x = *(const DiffContext **) x;
+  const DiffContext *ctx_y = *(const DiffContext **) y;
+  size_t size_x = ctx_x->tokens_old.len + ctx_x->tokens_new.len;
+  size_t size_y = ctx_y->tokens_old.len + ctx_y->tokens_new.len;
+  return (size_x < size_y) - (size_x > size_y);
+}
+
+static void
+diff_pool_destroy(DiffPool *pool) {
+  for(size_t i = 0; i < pool->workers_len; i++) {
+    diff_workspace_destroy(&pool->workers[i].ws);
+  }
+  for(size_t i = 0; i < pool->contexts_len; i++) {
+    diff_context_destroy(&pool->contexts[i]);
+  }
+  xfree(pool->workers);
+  xfree(pool->queues);
+  xfree(pool->jobs);
+  xfree(pool->prepared);
+  xfree(pool->contexts);
+}
 
-  if(ctx.output_eq && suffix_len > 0) {
-    rb_ary_push(ctx.rb_out_ary, rb_change_set_new_full(CHANGE_TYPE_EQL, ctx.rb_old, ctx.rb_new,
-                                                        ctx.tokens_old.data, ctx.tokens_old.len - suffix_len, suffix_len,
-                                                        ctx.tokens_new.data, ctx.tokens_new.len - suffix_len, suffix_len));
+/* Runs all jobs of the pool with the GVL released. Interrupts are
+   handled like in diff_tokens(), unfinished jobs are rerun. A pending
+   exception propagates right away, the caller destroys the pool */
+static void
+diff_pool_run(DiffPool *pool) {
+  // largest jobs first, dealt round-robin so that all queues start out balanced
+  DiffContext **sorted = RB_ALLOC_N(DiffContext *, pool->jobs_len);
+  memcpy(sorted, pool->jobs, pool->jobs_len * sizeof(DiffContext *));
+  qsort(sorted, pool->jobs_len, sizeof(DiffContext *), diff_job_cmp);
+
+  size_t job_index = 0;
+  for(size_t i = 0; i < pool->workers_len; i++) {
+    for(size_t j = i; j < pool->jobs_len; j += pool->workers_len) {
+      pool->jobs[job_index++] = sorted[j];
+    }
   }
+  xfree(sorted);
 
-  //  ctx.tokens_new_ = ctx.tokens_new.data;
-  //  ctx.tokens_old_ = ctx.tokens_old.data;
-  //  token_diff2(&ctx, 0, ctx.tokens_old.len,
-  //                 0, ctx.tokens_new.len);
+  while(true) {
+    size_t queue_start = 0;
+    for(size_t i = 0; i < pool->workers_len; i++) {
+      DiffQueue *queue = &pool->queues[i];
+      size_t queue_len = (pool->jobs_len - i + pool->workers_len - 1) / pool->workers_len;
+      atomic_store(&queue->next, queue_start);
+      queue->end = queue_start + queue_len;
+      queue_start = queue->end;
+    }
 
-  // uint32_t tree_idx = token_diff(&ctx,
-  //                                prefix_len, ctx.tokens_old.len - suffix_len - prefix_len,
-  //                                prefix_len, ctx.tokens_new.len - suffix_len - prefix_len);
+    pool->interrupted = false;
+    for(size_t i = 0; i < pool->jobs_len; i++) {
+      pool->jobs[i]->engine.interrupted = false;
+    }
 
+    rb_thread_call_without_gvl2(diff_pool_run_nogvl, pool, diff_pool_ubf, pool);
 
+    bool finished = true;
+    for(size_t i = 0; i < pool->jobs_len; i++) {
+      finished = finished && pool->jobs[i]->finished;
+    }
+    if(finished) break;
 
-  // token_diff(tokens_old, tokens_new, &index_list, table_entries_old, match_map, _overlap, old_index_map,
-  //           rb_old, rb_new, 0, tokens_old_len, 0, tokens_new_len, rb_out_ary, output_eq);
+    rb_thread_check_ints();
+  }
+}
 
-  // change_set_from_tree(&ctx, tree_idx, rb_out_ary);
+static size_t
+default_thread_count(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (size_t) count : 1;
+}
 
+// A diff_many call, its contexts are configured like template
+typedef struct {
+  DiffPool pool;
+  DiffContext template;
+  VALUE rb_pairs;
+  size_t threads;
+  bool ignore_whitespace;
+  bool ignore_comments;
+} DiffMany;
 
-done:
-  // st_free_table(match_map);
-  // st_free_table(next_match_map);
-  // match_map_destroy(&ctx.match_map);
-  // match_map_destroy(&ctx.next_match_map);
-  path_array_destroy(&ctx.path_array);
-  tmp_token_array_destroy(&ctx.tmp_tokens_new);
-  tmp_token_array_destroy(&ctx.tmp_tokens_old);
-  xfree(ctx.tokens_old.data);
-  xfree(ctx.tokens_new.data);
+static VALUE
+diff_many_run(VALUE arg) {
+  DiffMany *many = (DiffMany *) arg;
+  DiffPool *pool = &many->pool;
+  long pairs_len = RARRAY_LEN(many->rb_pairs);
+
+  pool->contexts = RB_ALLOC_N(DiffContext, pairs_len);
+  pool->prepared = RB_ZALLOC_N(bool, pairs_len);
+  pool->jobs = RB_ALLOC_N(DiffContext *, pairs_len);
+
+  // a pair that raises leaves itself and the ones before it to diff_many_ensure
+  for(long i = 0; i < pairs_len; i++) {
+    VALUE rb_pair = RARRAY_AREF(many->rb_pairs, i);
+    DiffContext *ctx = &pool->contexts[i];
+
+    *ctx = many->template;
+    pool->contexts_len++;
+    pool->prepared[i] = diff_context_prepare(ctx, RARRAY_AREF(rb_pair, 0), RARRAY_AREF(rb_pair, 1),
+                                             many->ignore_whitespace, many->ignore_comments);
+    if(pool->prepared[i]) {
+      pool->jobs[pool->jobs_len++] = ctx;
+    }
+  }
 
-  return rb_out_ary;
+  size_t workers_len = MAX(1, MIN(many->threads, pool->jobs_len));
+  pool->workers = RB_ALLOC_N(DiffWorker, workers_len);
+  pool->queues = RB_ALLOC_N(DiffQueue, workers_len);
+  for(size_t i = 0; i < workers_len; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    diff_workspace_init(&pool->workers[i].ws);
+  }
+  pool->workers_len = workers_len;
+
+  diff_pool_run(pool);
+
+  VALUE rb_results = rb_ary_new_capa(pairs_len);
+  for(long i = 0; i < pairs_len; i++) {
+    DiffContext *ctx = &pool->contexts[i];
+    // contexts live on the malloc heap, rb_results keeps the array alive
+    ctx->rb_out_ary = rb_ary_new();
+    rb_ary_push(rb_results, ctx->rb_out_ary);
+    if(pool->prepared[i]) {
+      diff_context_output(ctx);
+    }
+  }
+
+  return rb_results;
+}
+
+static VALUE
+diff_many_ensure(VALUE arg) {
+  DiffMany *many = (DiffMany *) arg;
+  diff_pool_destroy(&many->pool);
+  return Qnil;
+}
+
+static VALUE
+rb_ts_diff_diff_many_s(VALUE self, VALUE rb_pairs, VALUE rb_threads,
+                       VALUE rb_output_eq, VALUE rb_output_replace, VALUE rb_ignore_whitespace, VALUE rb_ignore_comments,
+                       VALUE rb_algorithm, VALUE rb_max_cost, VALUE rb_anchor_subtrees, VALUE rb_split_lines) {
+  Check_Type(rb_pairs, T_ARRAY);
+
+  // the nodes must outlive the GVL-free phase, whatever happens to rb_pairs
+  rb_pairs = rb_ary_dup(rb_pairs);
+  long pairs_len = RARRAY_LEN(rb_pairs);
+
+  for(long i = 0; i < pairs_len; i++) {
+    VALUE rb_pair = RARRAY_AREF(rb_pairs, i);
+    Check_Type(rb_pair, T_ARRAY);
+    if(RARRAY_LEN(rb_pair) != 2) {
+      rb_raise(rb_eArgError, "expected pairs of [old, new], got an array of size %ld", RARRAY_LEN(rb_pair));
+    }
+  }
+
+  DiffMany many;
+  memset(&many, 0, sizeof(DiffMany));
+
+  many.rb_pairs = rb_pairs;
+  many.threads = NIL_P(rb_threads) ? default_thread_count() : NUM2SIZET(rb_threads);
+  if(many.threads == 0) {
+    rb_raise(rb_eArgError, "threads must be positive");
+  }
+
+  many.ignore_whitespace = RB_TEST(rb_ignore_whitespace);
+  many.ignore_comments = RB_TEST(rb_ignore_comments);
+
+  DiffContext *template = &many.template;
+  template->output_eq = RB_TEST(rb_output_eq);
+  template->output_replace = RB_TEST(rb_output_replace);
+  template->split_lines = RB_TEST(rb_split_lines);
+  template->lazy = false;
+  template->engine.algorithm = diff_algorithm_from_sym(rb_algorithm);
+  template->engine.max_cost = max_cost_from_value(rb_max_cost);
+  template->anchor_min_len = anchor_min_len_from_value(rb_anchor_subtrees);
+  template->edit_windows = NULL;
+  template->edit_windows_len = 0;
+  template->rb_out_str = Qnil;
+  diff_context_check_strategy(template, 0);
+  template->engine.stats = NULL;
+
+  VALUE rb_results = rb_ensure(diff_many_run, (VALUE) &many, diff_many_ensure, (VALUE) &many);
+
+  RB_GC_GUARD(rb_pairs);
+
+  return rb_results;
 }
 
 static VALUE
@@ -1696,6 +2188,24 @@ typedef enum {
 void
 rb_node_pq_profile_(TSNode node, Tree *tree, PQAction action, VALUE rb_p, VALUE rb_q, VALUE rb_include_root_ancestors, VALUE rb_raw, VALUE rb_pairs, VALUE rb_only_named, VALUE rb_max_depth, VALUE rb_profile);
 
+#define PQ_GRAM_HASH_SEED 0xcbf29ce484222325ULL
+#define PQ_GRAM_HASH_MUL 0x100000001b3ULL
+
+static uint64_t
+pq_gram_hash_bytes(uint64_t hash, const char *bytes, long len) {
+  for(long i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t) bytes[i]) * PQ_GRAM_HASH_MUL;
+  }
+  return hash;
+}
+
+static int
+pq_gram_cmp(const void *x, const void *y) {
+  uint64_t a = *(const uint64_t *) x;
+  uint64_t b = *(const uint64_t *) y;
+  return a < b ? -1 : (a > b ? 1 : 0);
+}
+
 static void
 tokens_to_pq_profile(Token *tokens, size_t tokens_len, PQAction action, VALUE rb_p, VALUE rb_q, VALUE rb_include_root_ancestors, VALUE rb_raw, VALUE rb_pairs, VALUE rb_only_named, VALUE rb_max_depth, VALUE rb_profile) {
   for(size_t i = 0; i < tokens_len; i++) {
@@ -1705,12 +2215,327 @@ tokens_to_pq_profile(Token *tokens, size_t tokens_len, PQAction action, VALUE rb
   }
 }
 
+/* Builds the pq-gram profile of a tree as 64-bit fingerprints, one per gram.
+   Labels are FNV-1a hashes of the node type names, as in the packed
+   profiles of change sets, 0 stands for the * padding. labels holds the
+   ancestors of the current node by depth, bases the sliding window over
+   the last q children of each of them */
+typedef struct {
+  uint32_t p;
+  uint32_t q;
+  bool named_only;
+  uint64_t *labels;
+  uint64_t *bases;
+  bool *has_children;
+  uint32_t depth_capa;
+  // label of each symbol seen so far, 0 if not hashed yet
+  uint64_t *symbol_labels;
+  uint32_t symbol_labels_len;
+  uint64_t *grams;
+  size_t grams_len;
+  size_t grams_capa;
+} PQGramProfile;
+
+// Hashes the label as its 8 little-endian bytes
+static uint64_t
+pq_gram_hash_label(uint64_t hash, uint64_t label) {
+  for(int i = 0; i < 8; i++) {
+    hash = (hash ^ (uint8_t) (label >> (8 * i))) * PQ_GRAM_HASH_MUL;
+  }
+  return hash;
+}
+
+static uint64_t
+pq_gram_label(PQGramProfile *profile, TSNode node) {
+  uint16_t symbol = ts_node_symbol(node);
+
+  if(symbol >= profile->symbol_labels_len) {
+    uint32_t new_len = MAX((uint32_t) symbol + 1, 2 * profile->symbol_labels_len);
+    RB_REALLOC_N(profile->symbol_labels, uint64_t, new_len);
+    memset(profile->symbol_labels + profile->symbol_labels_len, 0, (new_len - profile->symbol_labels_len) * sizeof(uint64_t));
+    profile->symbol_labels_len = new_len;
+  }
+
+  uint64_t *label = &profile->symbol_labels[symbol];
+  if(*label == 0) {
+    const char *type = ts_node_type(node);
+    *label = pq_gram_hash_bytes(PQ_GRAM_HASH_SEED, type, (long) strlen(type));
+    if(*label == 0) *label = 1;
+  }
+  return *label;
+}
+
+static void
+pq_gram_emit(PQGramProfile *profile, uint32_t depth) {
+  uint64_t hash = PQ_GRAM_HASH_SEED;
+
+  for(uint32_t i = 0; i < profile->p; i++) {
+    int64_t ancestor = (int64_t) depth - (profile->p - 1) + i;
+    hash = pq_gram_hash_label(hash, ancestor >= 0 ? profile->labels[ancestor] : 0);
+  }
+
+  uint64_t *base = &profile->bases[depth * profile->q];
+  for(uint32_t i = 0; i < profile->q; i++) {
+    hash = pq_gram_hash_label(hash, base[i]);
+  }
+
+  if(!(profile->grams_len < profile->grams_capa)) {
+    size_t new_capa = 2 * profile->grams_capa;
+    RB_REALLOC_N(profile->grams, uint64_t, new_capa);
+    profile->grams_capa = new_capa;
+  }
+  profile->grams[profile->grams_len++] = hash;
+}
+
+static void
+pq_gram_shift(PQGramProfile *profile, uint32_t depth, uint64_t label) {
+  uint64_t *base = &profile->bases[depth * profile->q];
+  memmove(base, base + 1, (profile->q - 1) * sizeof(uint64_t));
+  base[profile->q - 1] = label;
+}
+
+static void
+pq_gram_enter(PQGramProfile *profile, uint32_t depth, TSNode node) {
+  if(depth >= profile->depth_capa) {
+    uint32_t new_capa = 2 * profile->depth_capa;
+    RB_REALLOC_N(profile->labels, uint64_t, new_capa);
+    RB_REALLOC_N(profile->bases, uint64_t, (size_t) new_capa * profile->q);
+    RB_REALLOC_N(profile->has_children, bool, new_capa);
+    profile->depth_capa = new_capa;
+  }
+
+  profile->labels[depth] = pq_gram_label(profile, node);
+  memset(&profile->bases[depth * profile->q], 0, profile->q * sizeof(uint64_t));
+  profile->has_children[depth] = false;
+}
+
+// Emits the gram of a child node, its own grams follow once it is entered
+static void
+pq_gram_child(PQGramProfile *profile, uint32_t depth, TSNode child) {
+  profile->has_children[depth] = true;
+  pq_gram_shift(profile, depth, pq_gram_label(profile, child));
+  pq_gram_emit(profile, depth);
+}
+
+// A leaf has a single gram with an empty base, other nodes pad their last children
+static void
+pq_gram_leave(PQGramProfile *profile, uint32_t depth) {
+  if(!profile->has_children[depth]) {
+    pq_gram_emit(profile, depth);
+    return;
+  }
+
+  for(uint32_t i = 1; i < profile->q; i++) {
+    pq_gram_shift(profile, depth, 0);
+    pq_gram_emit(profile, depth);
+  }
+}
+
+// Moves the cursor on to the next sibling that is part of the profile
+static bool
+pq_gram_next_sibling(PQGramProfile *profile, TSTreeCursor *cursor) {
+  while(ts_tree_cursor_goto_next_sibling(cursor)) {
+    if(!profile->named_only || ts_node_is_named(ts_tree_cursor_current_node(cursor))) return true;
+  }
+  return false;
+}
+
+static bool
+pq_gram_first_child(PQGramProfile *profile, TSTreeCursor *cursor) {
+  if(!ts_tree_cursor_goto_first_child(cursor)) return false;
+  if(!profile->named_only || ts_node_is_named(ts_tree_cursor_current_node(cursor))) return true;
+  if(pq_gram_next_sibling(profile, cursor)) return true;
+  ts_tree_cursor_goto_parent(cursor);
+  return false;
+}
+
+// Walks the tree with a cursor, so wide nodes do not cost quadratic time
+static void
+pq_gram_profile_build(PQGramProfile *profile, TSNode root) {
+  TSTreeCursor cursor = ts_tree_cursor_new(root);
+  uint32_t depth = 0;
+  bool done = false;
+
+  pq_gram_enter(profile, depth, root);
+
+  while(!done) {
+    if(pq_gram_first_child(profile, &cursor)) {
+      TSNode child = ts_tree_cursor_current_node(&cursor);
+      pq_gram_child(profile, depth, child);
+      pq_gram_enter(profile, ++depth, child);
+      continue;
+    }
+
+    while(true) {
+      pq_gram_leave(profile, depth);
+      if(depth == 0) {
+        done = true;
+        break;
+      }
+
+      if(pq_gram_next_sibling(profile, &cursor)) {
+        TSNode sibling = ts_tree_cursor_current_node(&cursor);
+        pq_gram_child(profile, depth - 1, sibling);
+        pq_gram_enter(profile, depth, sibling);
+        break;
+      }
+
+      ts_tree_cursor_goto_parent(&cursor);
+      depth--;
+    }
+  }
+
+  ts_tree_cursor_delete(&cursor);
+  qsort(profile->grams, profile->grams_len, sizeof(uint64_t), pq_gram_cmp);
+}
+
+static void
+pq_gram_profile_init(PQGramProfile *profile, uint32_t p, uint32_t q, bool named_only) {
+  profile->p = p;
+  profile->q = q;
+  profile->named_only = named_only;
+  profile->depth_capa = 32;
+  profile->labels = RB_ALLOC_N(uint64_t, profile->depth_capa);
+  profile->bases = RB_ALLOC_N(uint64_t, (size_t) profile->depth_capa * q);
+  profile->has_children = RB_ALLOC_N(bool, profile->depth_capa);
+  profile->symbol_labels = NULL;
+  profile->symbol_labels_len = 0;
+  profile->grams_capa = 256;
+  profile->grams_len = 0;
+  profile->grams = RB_ALLOC_N(uint64_t, profile->grams_capa);
+}
+
+static void
+pq_gram_profile_destroy(PQGramProfile *profile) {
+  xfree(profile->labels);
+  xfree(profile->bases);
+  xfree(profile->has_children);
+  xfree(profile->symbol_labels);
+  xfree(profile->grams);
+}
+
+/* Grams of one token of a packed profile: for the token and each of up
+   to max_depth ancestors above it, the gram with that node at the end of
+   its stem and, for an ancestor, the last q children up to the one on
+   the way to the token as its base. A token is taken for a leaf, so
+   these are grams of the whole tree's profile. Stems reach above
+   max_depth only with include_root_ancestors, the rest is * padding.
+   With pairs, the action is hashed after the labels */
+static void
+pq_gram_token(PQGramProfile *profile, TSNode node, PQAction action, uint32_t max_depth,
+              bool include_root_ancestors, bool pairs, TSNode *path) {
+  if(profile->named_only && !ts_node_is_named(node)) return;
+
+  uint32_t path_len = 0;
+  uint32_t path_capa = max_depth + profile->p;
+  while(path_len < path_capa && !ts_node_is_null(node)) {
+    path[path_len++] = node;
+    node = ts_node_parent(node);
+  }
+
+  uint32_t levels = MIN(max_depth + 1, path_len);
+  uint32_t stem_len = include_root_ancestors ? path_len : levels;
+
+  for(uint32_t k = 0; k < levels; k++) {
+    uint64_t hash = PQ_GRAM_HASH_SEED;
+
+    for(uint32_t i = profile->p; i-- > 0;) {
+      hash = pq_gram_hash_label(hash, k + i < stem_len ? pq_gram_label(profile, path[k + i]) : 0);
+    }
+
+    if(k == 0) {
+      for(uint32_t i = 0; i < profile->q; i++) {
+        hash = pq_gram_hash_label(hash, 0);
+      }
+    } else {
+      // no tree is walked, so the window of depth 0 serves as scratch
+      uint64_t *base = profile->bases;
+      TSNode child = path[k - 1];
+      for(uint32_t i = profile->q; i-- > 0;) {
+        base[i] = ts_node_is_null(child) ? 0 : pq_gram_label(profile, child);
+        if(!ts_node_is_null(child)) {
+          child = profile->named_only ? ts_node_prev_named_sibling(child) : ts_node_prev_sibling(child);
+        }
+      }
+      for(uint32_t i = 0; i < profile->q; i++) {
+        hash = pq_gram_hash_label(hash, base[i]);
+      }
+    }
+
+    if(pairs) {
+      hash = pq_gram_hash_label(hash, (uint64_t) action);
+    }
+
+    if(!(profile->grams_len < profile->grams_capa)) {
+      size_t new_capa = 2 * profile->grams_capa;
+      RB_REALLOC_N(profile->grams, uint64_t, new_capa);
+      profile->grams_capa = new_capa;
+    }
+    profile->grams[profile->grams_len++] = hash;
+  }
+}
+
+/* The profile as a binary String of 64-bit little-endian gram
+   fingerprints, sorted so that equal profiles compare equal byte for
+   byte. Grams are hashed as in pq_gram_distance, see pq_gram_token for
+   which ones a token contributes. They are built straight from the
+   tree-sitter nodes, raw makes no difference */
+static VALUE
+change_set_packed_pq_profile(ChangeSet *change_set, VALUE rb_p, VALUE rb_q, VALUE rb_include_root_ancestors, VALUE rb_pairs, VALUE rb_named_only, VALUE rb_max_depth) {
+  uint32_t p = NUM2UINT(rb_p);
+  uint32_t q = NUM2UINT(rb_q);
+  uint32_t max_depth = NUM2UINT(rb_max_depth);
+  bool include_root_ancestors = RB_TEST(rb_include_root_ancestors);
+  bool pairs = RB_TEST(rb_pairs);
+
+  if(p < 1 || q < 1) {
+    rb_raise(rb_eArgError, "p and q must be positive");
+  }
+
+  PQGramProfile profile;
+  pq_gram_profile_init(&profile, p, q, RB_TEST(rb_named_only));
+  TSNode *path = RB_ALLOC_N(TSNode, (size_t) max_depth + p);
+
+  for(int side = 0; side < 2; side++) {
+    Token *tokens = side == 0 ? change_set->old_tokens : change_set->new_tokens;
+    uint32_t tokens_len = side == 0 ? change_set->old_len : change_set->new_len;
+    PQAction action = side == 0 ? PQ_ACTION_DELETE : PQ_ACTION_INSERT;
+
+    for(uint32_t i = 0; i < tokens_len; i++) {
+      if(ts_node_is_null(tokens[i].ts_node)) continue;
+      pq_gram_token(&profile, tokens[i].ts_node, action, max_depth, include_root_ancestors, pairs, path);
+    }
+  }
+  xfree(path);
+
+  qsort(profile.grams, profile.grams_len, sizeof(uint64_t), pq_gram_cmp);
+
+  VALUE rb_packed = rb_str_buf_new((long) (profile.grams_len * 8));
+  char *packed = RSTRING_PTR(rb_packed);
+  for(size_t i = 0; i < profile.grams_len; i++) {
+    for(int k = 0; k < 8; k++) {
+      packed[8 * i + k] = (char) (profile.grams[i] >> (8 * k));
+    }
+  }
+  rb_str_set_len(rb_packed, (long) (profile.grams_len * 8));
+  pq_gram_profile_destroy(&profile);
+
+  return rb_packed;
+}
+
 static VALUE
-rb_change_set_pq_profile(VALUE self, VALUE rb_p, VALUE rb_q, VALUE rb_profile, VALUE rb_include_root_ancestors, VALUE rb_raw, VALUE rb_pairs, VALUE rb_named_only, VALUE rb_max_depth)
+rb_change_set_pq_profile(VALUE self, VALUE rb_p, VALUE rb_q, VALUE rb_profile, VALUE rb_include_root_ancestors, VALUE rb_raw, VALUE rb_pairs, VALUE rb_named_only, VALUE rb_max_depth, VALUE rb_packed)
 {
   ChangeSet *change_set;
   TypedData_Get_Struct(self, ChangeSet, &change_set_type, change_set);
 
+  if(RB_TEST(rb_packed)) {
+    if(!RB_NIL_P(rb_profile)) {
+      rb_raise(rb_eArgError, "a packed profile cannot be appended to");
+    }
+    return change_set_packed_pq_profile(change_set, rb_p, rb_q, rb_include_root_ancestors, rb_pairs, rb_named_only, rb_max_depth);
+  }
+
   if(RB_NIL_P(rb_profile)) {
     rb_profile = rb_ary_new_capa(64);
   } else {
@@ -1722,6 +2547,360 @@ rb_change_set_pq_profile(VALUE self, VALUE rb_p, VALUE rb_q, VALUE rb_profile, V
   return rb_profile;
 }
 
+// Size of the multiset intersection of two sorted profiles
+static size_t
+pq_gram_intersection(PQGramProfile *a, PQGramProfile *b) {
+  size_t i = 0, j = 0, common = 0;
+  while(i < a->grams_len && j < b->grams_len) {
+    if(a->grams[i] < b->grams[j]) {
+      i++;
+    } else if(a->grams[i] > b->grams[j]) {
+      j++;
+    } else {
+      common++;
+      i++;
+      j++;
+    }
+  }
+  return common;
+}
+
+/* The tree-sitter node of a node or TokenizedTree, unwrapped the way
+   the tokenizer does it. Returns false for a null node */
+static bool
+node_from_value(VALUE rb_node, TSNode *out_node) {
+  if(rb_typeddata_is_kind_of(rb_node, &tokenized_tree_type)) {
+    TokenizedTree *tokenized = RTYPEDDATA_DATA(rb_node);
+    rb_node = tokenized->rb_node;
+  }
+
+  *out_node = rb_node_unwrap(rb_node)->ts_node;
+  return !ts_node_is_null(*out_node);
+}
+
+/* Normalized pq-gram distance, 1 - 2 |A ∩ B| / (|A| + |B|) over the
+   profiles as multisets, built and compared without any Ruby objects */
+static VALUE
+rb_ts_diff_pq_gram_distance_s(VALUE self, VALUE rb_a, VALUE rb_b, VALUE rb_p, VALUE rb_q, VALUE rb_named_only) {
+  uint32_t p = NUM2UINT(rb_p);
+  uint32_t q = NUM2UINT(rb_q);
+  bool named_only = RB_TEST(rb_named_only);
+
+  if(p < 1 || q < 1) {
+    rb_raise(rb_eArgError, "p and q must be positive");
+  }
+
+  TSNode node_a, node_b;
+  bool has_a = node_from_value(rb_a, &node_a);
+  bool has_b = node_from_value(rb_b, &node_b);
+
+  PQGramProfile profile_a, profile_b;
+  pq_gram_profile_init(&profile_a, p, q, named_only);
+  pq_gram_profile_init(&profile_b, p, q, named_only);
+  if(has_a) pq_gram_profile_build(&profile_a, node_a);
+  if(has_b) pq_gram_profile_build(&profile_b, node_b);
+
+  size_t common = pq_gram_intersection(&profile_a, &profile_b);
+  size_t total = profile_a.grams_len + profile_b.grams_len;
+
+  pq_gram_profile_destroy(&profile_a);
+  pq_gram_profile_destroy(&profile_b);
+
+  RB_GC_GUARD(rb_a);
+  RB_GC_GUARD(rb_b);
+
+  return DBL2NUM(total == 0 ? 0.0 : 1.0 - 2.0 * (double) common / (double) total);
+}
+
+// Ranges [start, end) over the tokens, one per run of tokens that touch end to start
+static VALUE
+token_byte_ranges(Token *tokens, uint32_t tokens_len) {
+  VALUE rb_ranges = rb_ary_new();
+
+  uint32_t i = 0;
+  while(i < tokens_len) {
+    uint32_t start_byte = tokens[i].start_byte;
+    uint32_t end_byte = tokens[i].end_byte;
+    for(i++; i < tokens_len && tokens[i].start_byte == end_byte; i++) {
+      end_byte = tokens[i].end_byte;
+    }
+    rb_ary_push(rb_ranges, rb_range_new(UINT2NUM(start_byte), UINT2NUM(end_byte), true));
+  }
+  return rb_ranges;
+}
+
+/* The byte ranges of the old and new tokens, without creating a Token
+   for each. Tokens separated by ignored whitespace or comments go into
+   separate ranges, so the ranges cover only the bytes of the tokens.
+   An empty side has no ranges */
+static VALUE
+rb_change_set_byte_ranges(VALUE self)
+{
+  ChangeSet *change_set;
+  TypedData_Get_Struct(self, ChangeSet, &change_set_type, change_set);
+
+  return rb_assoc_new(token_byte_ranges(change_set->old_tokens, change_set->old_len),
+                      token_byte_ranges(change_set->new_tokens, change_set->new_len));
+}
+
+typedef struct {
+  const char *input;
+  uint32_t lower;
+  uint32_t upper;
+  // line of byte, counted from 1 at the start of input
+  uint32_t byte;
+  uint32_t line;
+} LineCursor;
+
+static void
+line_cursor_init(LineCursor *cursor, VALUE rb_input) {
+  uint32_t start;
+  uint32_t len;
+  cursor->input = rb_node_input_(rb_input, &start, &len);
+  cursor->lower = start;
+  cursor->upper = start + len;
+  cursor->byte = 0;
+  cursor->line = 1;
+}
+
+// Line of byte, which must not lie before the previous one asked for
+static uint32_t
+line_cursor_seek(LineCursor *cursor, uint32_t byte) {
+  assert(byte >= cursor->byte);
+  const char *p = cursor->input + cursor->byte;
+  const char *end = cursor->input + byte;
+  while((p = memchr(p, '\n', (size_t) (end - p))) != NULL) {
+    cursor->line++;
+    p++;
+  }
+  cursor->byte = byte;
+  return cursor->line;
+}
+
+/* Start of the line containing byte, moved back by up to lines more
+   lines, which are counted in *moved */
+static uint32_t
+line_cursor_start(LineCursor *cursor, uint32_t byte, uint32_t lines, uint32_t *moved) {
+  *moved = 0;
+  while(true) {
+    while(byte > cursor->lower && cursor->input[byte - 1] != '\n') byte--;
+    if(*moved == lines || byte == cursor->lower) return byte;
+    byte--;
+    (*moved)++;
+  }
+}
+
+/* End of the line containing byte, including its newline, moved on by
+   up to lines more lines, which are counted in *moved */
+static uint32_t
+line_cursor_end(LineCursor *cursor, uint32_t byte, uint32_t lines, uint32_t *moved) {
+  *moved = 0;
+  while(true) {
+    const char *newline = memchr(cursor->input + byte, '\n', cursor->upper - byte);
+    if(newline == NULL) return cursor->upper;
+    byte = (uint32_t) (newline - cursor->input) + 1;
+    if(*moved == lines || byte == cursor->upper) return byte;
+    (*moved)++;
+  }
+}
+
+/* Byte range of one side of a change set. An empty side is the point
+   after the token before it, as in diff_ranges */
+static void
+change_set_side_bytes(Token *tokens, uint32_t len, Token *first, uint32_t lower, uint32_t *start, uint32_t *end) {
+  if(len > 0) {
+    *start = tokens[0].start_byte;
+    *end = tokens[len - 1].end_byte;
+  } else {
+    *start = *end = tokens != NULL && tokens > first ? tokens[-1].end_byte : lower;
+  }
+}
+
+typedef struct {
+  ChangeSet *change_set;
+  uint32_t old_start;
+  uint32_t old_end;
+  uint32_t new_start;
+  uint32_t new_end;
+  uint32_t old_first_line;
+  uint32_t old_last_line;
+  uint32_t new_first_line;
+  uint32_t new_last_line;
+} RenderChange;
+
+/* Renders the changes as hunks of the new input, with context lines
+   around them, in the style of git diff --word-diff. Deleted text is
+   enclosed in [-...-] and inserted text in {+...+}. The old line range
+   in the hunk header assumes that context lines did not change */
+static VALUE
+rb_ts_diff_render_s(VALUE self, VALUE rb_change_sets, VALUE rb_context) {
+  Check_Type(rb_change_sets, T_ARRAY);
+  uint32_t context = NUM2UINT(rb_context);
+  long change_sets_len = RARRAY_LEN(rb_change_sets);
+
+  // everything that can raise is checked before changes is allocated
+  VALUE rb_arena = Qnil;
+  ChangeSet *prev = NULL;
+  long changes_len = 0;
+
+  for(long i = 0; i < change_sets_len; i++) {
+    ChangeSet *change_set;
+    TypedData_Get_Struct(RARRAY_AREF(rb_change_sets, i), ChangeSet, &change_set_type, change_set);
+    if(NIL_P(rb_arena)) {
+      rb_arena = change_set->rb_arena;
+    } else if(rb_arena != change_set->rb_arena) {
+      rb_raise(rb_eArgError, "change sets must come from the same diff");
+    }
+    if(change_set->change_type == CHANGE_TYPE_EQL) continue;
+
+    // both sides are walked forward, see line_cursor_seek
+    if(prev != NULL && (change_set->old_tokens < prev->old_tokens + prev->old_len ||
+                        change_set->new_tokens < prev->new_tokens + prev->new_len)) {
+      rb_raise(rb_eArgError, "change sets must be in the order of the diff");
+    }
+    prev = change_set;
+    changes_len++;
+  }
+
+  if(changes_len == 0) {
+    return rb_str_new(NULL, 0);
+  }
+
+  TokenArena *arena;
+  TypedData_Get_Struct(rb_arena, TokenArena, &token_arena_type, arena);
+
+  LineCursor old_cursor;
+  LineCursor new_cursor;
+  line_cursor_init(&old_cursor, arena->rb_old);
+  line_cursor_init(&new_cursor, arena->rb_new);
+
+  RenderChange *changes = RB_ALLOC_N(RenderChange, changes_len);
+  for(long i = 0, k = 0; i < change_sets_len; i++) {
+    ChangeSet *change_set = RTYPEDDATA_DATA(RARRAY_AREF(rb_change_sets, i));
+    if(change_set->change_type == CHANGE_TYPE_EQL) continue;
+    changes[k++].change_set = change_set;
+  }
+
+  for(long i = 0; i < changes_len; i++) {
+    RenderChange *change = &changes[i];
+    ChangeSet *change_set = change->change_set;
+    change_set_side_bytes(change_set->old_tokens, change_set->old_len, arena->tokens_old.data, old_cursor.lower, &change->old_start, &change->old_end);
+    change_set_side_bytes(change_set->new_tokens, change_set->new_len, arena->tokens_new.data, new_cursor.lower, &change->new_start, &change->new_end);
+
+    change->old_first_line = line_cursor_seek(&old_cursor, change->old_start);
+    change->old_last_line = line_cursor_seek(&old_cursor, MAX(change->old_start, change->old_end - (change_set->old_len > 0)));
+    change->new_first_line = line_cursor_seek(&new_cursor, change->new_start);
+    change->new_last_line = line_cursor_seek(&new_cursor, MAX(change->new_start, change->new_end - (change_set->new_len > 0)));
+  }
+  uint32_t old_lines = line_cursor_seek(&old_cursor, old_cursor.upper);
+
+  // hunks are rendered twice, first only to size the output
+  VALUE rb_out = Qnil;
+  for(int pass = 0; pass < 2; pass++) {
+    size_t out_len = 0;
+
+    for(long i = 0; i < changes_len;) {
+      long j = i + 1;
+      while(j < changes_len && changes[j].new_first_line <= changes[j - 1].new_last_line + 2 * (uint64_t) context + 1) j++;
+
+      RenderChange *first = &changes[i];
+      RenderChange *last = &changes[j - 1];
+      uint32_t before;
+      uint32_t after;
+      uint32_t from = line_cursor_start(&new_cursor, first->new_start, context, &before);
+      uint32_t to = line_cursor_end(&new_cursor, MAX(last->new_start, last->new_end - (last->change_set->new_len > 0)), context, &after);
+
+      uint32_t old_first_line = first->old_first_line - MIN(before, first->old_first_line - 1);
+      uint32_t old_last_line = MIN(last->old_last_line + after, old_lines);
+      char header[64];
+      int header_len = snprintf(header, sizeof(header), "@@ -%u,%u +%u,%u @@\n",
+                                old_first_line, old_last_line - old_first_line + 1,
+                                first->new_first_line - before, last->new_last_line + after - (first->new_first_line - before) + 1);
+
+      if(pass == 0) {
+        out_len += header_len + (to - from);
+        for(long k = i; k < j; k++) {
+          out_len += (changes[k].old_end - changes[k].old_start) + 4 * 2;
+        }
+        out_len += 1;
+      } else {
+        rb_str_buf_cat(rb_out, header, header_len);
+        uint32_t pos = from;
+        for(long k = i; k < j; k++) {
+          RenderChange *change = &changes[k];
+          rb_str_buf_cat(rb_out, new_cursor.input + pos, change->new_start - pos);
+          if(change->change_set->old_len > 0) {
+            rb_str_buf_cat(rb_out, "[-", 2);
+            rb_str_buf_cat(rb_out, old_cursor.input + change->old_start, change->old_end - change->old_start);
+            rb_str_buf_cat(rb_out, "-]", 2);
+          }
+          if(change->change_set->new_len > 0) {
+            rb_str_buf_cat(rb_out, "{+", 2);
+            rb_str_buf_cat(rb_out, new_cursor.input + change->new_start, change->new_end - change->new_start);
+            rb_str_buf_cat(rb_out, "+}", 2);
+          }
+          pos = change->new_end;
+        }
+        rb_str_buf_cat(rb_out, new_cursor.input + pos, to - pos);
+        if(to == from || new_cursor.input[to - 1] != '\n') {
+          rb_str_buf_cat(rb_out, "\n", 1);
+        }
+      }
+
+      i = j;
+    }
+
+    if(pass == 0) {
+      rb_out = rb_str_buf_new((long) out_len);
+    }
+  }
+
+  xfree(changes);
+  RB_GC_GUARD(rb_arena);
+  return rb_out;
+}
+
+static VALUE
+rb_tokenized_tree_s_new(VALUE klass, VALUE rb_node, VALUE rb_ignore_whitespace, VALUE rb_ignore_comments)
+{
+  TokenizedTree *tokenized;
+  VALUE rb_tokenized = TypedData_Make_Struct(klass, TokenizedTree, &tokenized_tree_type, tokenized);
+  bool ignore_whitespace = RB_TEST(rb_ignore_whitespace);
+  bool ignore_comments = RB_TEST(rb_ignore_comments);
+
+  RB_OBJ_WRITE(rb_tokenized, &tokenized->rb_node, rb_node);
+  tokenized->ignore_whitespace = ignore_whitespace;
+  tokenized->ignore_comments = ignore_comments;
+  tokenized->input = rb_node_input_(rb_node, &tokenized->input_start, &tokenized->input_len);
+  tokenized->tokens = rb_node_tokenize_(rb_node, ignore_whitespace, ignore_comments);
+
+  tokenized->hashes = RB_ALLOC_N(st_index_t, MAX(tokenized->tokens.len, 1));
+  for(size_t i = 0; i < tokenized->tokens.len; i++) {
+    tokenized->hashes[i] = token_hash(&tokenized->tokens.data[i], tokenized->input);
+  }
+
+  uint32_t rb_trees_capa = 1;
+  tokenized->rb_trees = RB_ALLOC_N(VALUE, rb_trees_capa);
+  token_trees_collect(rb_tokenized, &tokenized->tokens, &tokenized->rb_trees, &tokenized->rb_trees_len, &rb_trees_capa);
+
+  return rb_obj_freeze(rb_tokenized);
+}
+
+static VALUE
+rb_tokenized_tree_node(VALUE self)
+{
+  TokenizedTree *tokenized;
+  TypedData_Get_Struct(self, TokenizedTree, &tokenized_tree_type, tokenized);
+  return tokenized->rb_node;
+}
+
+static VALUE
+rb_tokenized_tree_size(VALUE self)
+{
+  TokenizedTree *tokenized;
+  TypedData_Get_Struct(self, TokenizedTree, &tokenized_tree_type, tokenized);
+  return SIZET2NUM(tokenized->tokens.len);
+}
 
 static VALUE
 rb_change_set_old(VALUE self)
@@ -1766,12 +2945,23 @@ Init_core(void)
   id_del = rb_intern("-");
   id_eql = rb_intern("=");
   id_sub = rb_intern("!");
+  id_myers = rb_intern("myers");
+  id_patience = rb_intern("patience");
+  id_histogram = rb_intern("histogram");
+  id_last_stats = rb_intern("__tree_sitter_diff_last_stats__");
 
   VALUE rb_mTreeSitter = rb_define_module("TreeSitter");
   rb_mTSDiff = rb_define_module_under(rb_mTreeSitter, "Diff");
   rb_eTsDiffError = rb_define_class_under(rb_mTSDiff, "Error", rb_eStandardError);
 
-  rb_define_singleton_method(rb_mTSDiff, "__diff__", rb_ts_diff_diff_s, 6);
+  rb_define_singleton_method(rb_mTSDiff, "__diff__", rb_ts_diff_diff_s, 12);
+  rb_define_singleton_method(rb_mTSDiff, "__diff_ranges__", rb_ts_diff_diff_ranges_s, 12);
+  rb_define_singleton_method(rb_mTSDiff, "__render__", rb_ts_diff_render_s, 2);
+  rb_define_singleton_method(rb_mTSDiff, "__each_change__", rb_ts_diff_each_change_s, 12);
+  rb_define_singleton_method(rb_mTSDiff, "__distance__", rb_ts_diff_distance_s, 6);
+  rb_define_singleton_method(rb_mTSDiff, "last_stats", rb_ts_diff_last_stats_s, 0);
+  rb_define_singleton_method(rb_mTSDiff, "__pq_gram_distance__", rb_ts_diff_pq_gram_distance_s, 5);
+  rb_define_singleton_method(rb_mTSDiff, "__diff_many__", rb_ts_diff_diff_many_s, 10);
 
   rb_cChangeSet = rb_define_class_under(rb_mTSDiff, "ChangeSet", rb_cObject);
   rb_undef_alloc_func(rb_cChangeSet);
@@ -1783,9 +2973,17 @@ Init_core(void)
   rb_define_method(rb_cChangeSet, "old", rb_change_set_old, 0);
   rb_define_method(rb_cChangeSet, "new", rb_change_set_new_m, 0);
   rb_define_method(rb_cChangeSet, "each", rb_change_set_each, 0);
-  rb_define_method(rb_cChangeSet, "__pq_profile__", rb_change_set_pq_profile, 8);
+  rb_define_method(rb_cChangeSet, "byte_ranges", rb_change_set_byte_ranges, 0);
+  rb_define_method(rb_cChangeSet, "__pq_profile__", rb_change_set_pq_profile, 9);
   rb_include_module(rb_cChangeSet, rb_mEnumerable);
 
+  rb_cTokenizedTree = rb_define_class_under(rb_mTSDiff, "TokenizedTree", rb_cObject);
+  rb_undef_alloc_func(rb_cTokenizedTree);
+
+  rb_define_singleton_method(rb_cTokenizedTree, "__new__", rb_tokenized_tree_s_new, 3);
+  rb_define_method(rb_cTokenizedTree, "node", rb_tokenized_tree_node, 0);
+  rb_define_method(rb_cTokenizedTree, "size", rb_tokenized_tree_size, 0);
+
   // rb_define_method(rb_cToken, "==", rb_token_eql, 1);
   // rb_define_method(rb_cToken, "eql?", rb_token_eql, 1);
 
@@ -0,0 +1,1223 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "engine.h"
+
+#include <assert.h>
+
+/*
+Implementation based on this blog post:
+https://blog.jcoglan.com/2017/03/22/myers-diff-in-linear-space-theory/
+*/
+
+void *
+diff_engine_check_alloc(void *ptr, size_t size) {
+  if(ptr == NULL && size > 0) {
+    fprintf(stderr, "diff engine: failed to allocate %zu bytes\n", size);
+    abort();
+  }
+  return ptr;
+}
+
+static void
+path_array_init(PathArray *path_array, uint32_t capa) {
+  path_array->data = ENGINE_ALLOC_N(Path, capa);
+  path_array->capa = capa;
+  path_array->len = 0;
+}
+
+static void
+path_array_destroy(PathArray *path_array) {
+  ENGINE_FREE(path_array->data);
+}
+
+static uint32_t
+path_array_push(PathArray *path_array, Path **path) {
+  if(!(path_array->len < path_array->capa)) {
+    uint32_t new_capa = 2 * path_array->capa;
+    ENGINE_REALLOC_N(path_array->data, Path, new_capa);
+    path_array->capa = new_capa;
+  }
+  uint32_t index = path_array->len;
+  path_array->data[index] = (Path) {0, };
+  *path = &path_array->data[index];
+  path_array->len++;
+  return index;
+}
+
+static inline Path *
+path_array_get(PathArray *path_array, uint32_t idx) {
+  return &path_array->data[idx];
+}
+
+static void
+path_frame_stack_init(PathFrameStack *stack, uint32_t capa) {
+  stack->data = ENGINE_ALLOC_N(PathFrame, capa);
+  stack->capa = capa;
+  stack->len = 0;
+}
+
+static void
+path_frame_stack_destroy(PathFrameStack *stack) {
+  ENGINE_FREE(stack->data);
+}
+
+static void
+path_frame_stack_push(PathFrameStack *stack, PathFrame frame) {
+  if(!(stack->len < stack->capa)) {
+    uint32_t new_capa = 2 * stack->capa;
+    ENGINE_REALLOC_N(stack->data, PathFrame, new_capa);
+    stack->capa = new_capa;
+  }
+  stack->data[stack->len] = frame;
+  stack->len++;
+}
+
+void
+edit_script_init(EditScript *script, uint32_t capa) {
+  script->data = ENGINE_ALLOC_N(EditOp, capa);
+  script->capa = capa;
+  script->len = 0;
+}
+
+void
+edit_script_destroy(EditScript *script) {
+  ENGINE_FREE(script->data);
+}
+
+static void
+edit_script_push(EditScript *script, EditOp op) {
+  if(!(script->len < script->capa)) {
+    uint32_t new_capa = 2 * script->capa;
+    ENGINE_REALLOC_N(script->data, EditOp, new_capa);
+    script->capa = new_capa;
+  }
+  script->data[script->len] = op;
+  script->len++;
+}
+
+#define VGET(v, i) (v[(i) < 0 ? ((i) + (vlen)) : (i)])
+#define VSET(v, i, val) (v[(i) < 0 ? ((i) + (vlen)) : (i)] = val)
+
+// Boxes with at most this many edits are searched forward only, see find_path_greedy
+#define GREEDY_MAX_D 64
+
+static bool
+forward(DiffEngine *engine, Box *box, int64_t *vf, int64_t *vb, int64_t d, int64_t vlen, Snake *snake) {
+  for(int64_t k = d; k >= -d; k -= 2) {
+    int64_t c = k - BOX_DELTA(box);
+    int64_t px, x, y, py;
+
+    if(k == -d || (k != d && VGET(vf, k - 1) < VGET(vf, k + 1))) {
+      px = x = VGET(vf, k + 1);
+    }
+    else {
+      px = VGET(vf, k - 1);
+      x  = px + 1;
+    }
+
+    y = box->top + (x - box->left) - k;
+    py = (d == 0 || x != px) ? y : y - 1;
+
+    while(x < box->right && y < box->bottom && engine->ids_old_[x] == engine->ids_new_[y]) {
+      x++;
+      y++;
+    }
+
+    VSET(vf, k, x);
+
+    if(BOX_DELTA(box) % 2 != 0 && (c >= -(d - 1) && c <= d - 1) && y >= VGET(vb, c)) {
+      *snake = (Snake){px, py, x, y};
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static bool
+backward(DiffEngine *engine, Box *box, int64_t *vf, int64_t *vb, int64_t d, int64_t vlen, Snake *snake) {
+  for(int64_t c = d; c >= -d; c -= 2) {
+    int64_t k = c + BOX_DELTA(box);
+    int64_t px, x, y, py;
+
+    if(c == -d || (c != d && VGET(vb, c - 1) > VGET(vb, c + 1))) {
+      py = y = VGET(vb, c + 1);
+    }
+    else {
+      py = VGET(vb, c - 1);
+      y  = py - 1;
+    }
+
+    x = box->left + (y - box->top) + k;
+    px = (d == 0 || y != py) ? x : x + 1;
+
+    while(x > box->left && y > box->top && engine->ids_old_[x - 1] == engine->ids_new_[y - 1]) {
+      x--;
+      y--;
+    }
+
+    VSET(vb, c, y);
+
+    if(BOX_DELTA(box) % 2 == 0 && (k >= -d && k <= d) && x <= VGET(vf, k)) {
+      *snake = (Snake){x, y, px, py};
+      return true;
+    }
+  }
+  return false;
+}
+
+/* The V arrays of nested boxes are never live at the same time,
+   so all of them share one scratch region sized by the outermost box */
+static int64_t *
+v_scratch_reserve(DiffWorkspace *ws, size_t len) {
+  if(len > ws->v_scratch_capa) {
+    ENGINE_REALLOC_N(ws->v_scratch, int64_t, len);
+    ws->v_scratch_capa = len;
+  }
+  return ws->v_scratch;
+}
+
+/* Gives up on finding the middle snake after d steps, splitting the box
+   at the frontier point that got furthest instead, like xdiff does for
+   "too expensive" boxes. Fails if that point would not shrink the box */
+static bool
+split_furthest(Box *box, int64_t *vf, int64_t *vb, int64_t d, int64_t vlen, Snake *snake) {
+  int64_t best_fx = 0, best_fy = 0, best_forward = -1;
+  int64_t best_bx = 0, best_by = 0, best_backward = -1;
+
+  for(int64_t k = d; k >= -d; k -= 2) {
+    int64_t x = MIN(VGET(vf, k), box->right);
+    int64_t y = box->top + (x - box->left) - k;
+    if(y > box->bottom) {
+      y = box->bottom;
+      x = box->left + (y - box->top) + k;
+    }
+    if(x < box->left || y < box->top) continue;
+
+    int64_t progress = (x - box->left) + (y - box->top);
+    if(progress > best_forward && !(x == box->right && y == box->bottom)) {
+      best_forward = progress;
+      best_fx = x;
+      best_fy = y;
+    }
+  }
+
+  for(int64_t c = d; c >= -d; c -= 2) {
+    int64_t k = c + BOX_DELTA(box);
+    int64_t y = MAX(VGET(vb, c), box->top);
+    int64_t x = box->left + (y - box->top) + k;
+    if(x < box->left) {
+      x = box->left;
+      y = box->top + (x - box->left) - k;
+    }
+    if(x > box->right || y > box->bottom) continue;
+
+    int64_t progress = (box->right - x) + (box->bottom - y);
+    if(progress > best_backward && !(x == box->left && y == box->top)) {
+      best_backward = progress;
+      best_bx = x;
+      best_by = y;
+    }
+  }
+
+  if(best_forward <= 0 && best_backward <= 0) return false;
+
+  if(best_forward >= best_backward) {
+    *snake = (Snake){best_fx, best_fy, best_fx, best_fy};
+  } else {
+    *snake = (Snake){best_bx, best_by, best_bx, best_by};
+  }
+  return true;
+}
+
+static inline void
+count_box(DiffEngine *engine, int64_t d) {
+  if(engine->stats == NULL) return;
+  engine->stats->boxes++;
+  engine->stats->max_d = MAX(engine->stats->max_d, d);
+}
+
+/* Finds the middle snake of the box, and the step d it was found at, which
+   bounds the distance of the boxes on either side of it. A box split at
+   max_cost gets no bound */
+static bool
+midpoint(DiffEngine *engine, Box *box, Snake *snake, int64_t *out_d) {
+  if(BOX_SIZE(box) == 0) return false;
+
+  int64_t max = (BOX_SIZE(box) + 1) / 2;
+  int64_t vlen = 2 * max + 1;
+  int64_t *vf = v_scratch_reserve(engine->ws, 2 * vlen);
+  int64_t *vb = vf + vlen;
+
+  // step d only reads diagonals written by step d - 1,
+  // so apart from the starting diagonal nothing needs clearing
+  vf[1] = box->left;
+  vb[1] = box->bottom;
+
+  for(int64_t d = 0; d <= max; d++) {
+    if(engine->interrupted) {
+      return false;
+    }
+    if(d - 1 == engine->max_cost && split_furthest(box, vf, vb, d - 1, vlen, snake)) {
+      count_box(engine, d - 1);
+      *out_d = INT64_MAX;
+      return true;
+    }
+    if(forward(engine, box, vf, vb, d, vlen, snake) ||
+       backward(engine, box, vf, vb, d, vlen, snake)) {
+      count_box(engine, d);
+      *out_d = d;
+      return true;
+    }
+  }
+
+  count_box(engine, max);
+  return false;
+}
+
+
+static void
+find_path_init(DiffEngine *engine, int64_t left, int64_t top, int64_t right, int64_t bottom) {
+  PathFrameStack *stack = &engine->ws->path_frames;
+
+  engine->ws->path_array.len = 0;
+  stack->len = 0;
+  path_frame_stack_push(stack, (PathFrame) {
+    .box = {
+      .left = left,
+      .top = top,
+      .right = right,
+      .bottom = bottom
+    },
+    .has_point = false,
+    .max_d = GREEDY_MAX_D,
+  });
+}
+
+/* Edit distance of the box, from the step at which the frontiers of the
+   midpoint search meet: 2d - 1 when the forward one reaches the backward
+   one, 2d the other way round. Returns -1 once it would exceed max */
+static int64_t
+box_distance(DiffEngine *engine, Box *box, int64_t max) {
+  if(BOX_SIZE(box) == 0) return 0;
+  int64_t d_max = (BOX_SIZE(box) + 1) / 2;
+  int64_t vlen = 2 * d_max + 1;
+  int64_t *vf = v_scratch_reserve(engine->ws, 2 * vlen);
+  int64_t *vb = vf + vlen;
+  Snake snake;
+
+  vf[1] = box->left;
+  vb[1] = box->bottom;
+  for(int64_t d = 0; d <= d_max; d++) {
+    if(engine->interrupted || 2 * d - 1 > max) {
+      return -1;
+    }
+    if(forward(engine, box, vf, vb, d, vlen, &snake)) {
+      count_box(engine, d);
+      return 2 * d - 1;
+    }
+    if(2 * d > max) {
+      return -1;
+    }
+    if(backward(engine, box, vf, vb, d, vlen, &snake)) {
+      count_box(engine, d);
+      return 2 * d;
+    }
+  }
+  return -1;
+}
+
+static void
+path_array_push_point(DiffEngine *engine, int64_t x, int64_t y) {
+  PathArray *path_array = &engine->ws->path_array;
+  Path *path;
+
+  path_array_push(path_array, &path);
+  path->x = x;
+  path->y = y;
+  if(engine->stats != NULL) {
+    engine->stats->max_path_len = MAX(engine->stats->max_path_len, path_array->len);
+  }
+}
+
+/* Frontier of step d of the greedy search, the furthest x on diagonal k
+   (k = x - y, relative to the box), -1 if no path of d edits reaches it.
+   The frontiers of all steps are kept, step d at offset d * d */
+#define TRACE(d, k) (trace[(d) * (d) + (k) + (d)])
+
+/* Picks the predecessor of diagonal k at step d the way forward() does,
+   preferring the insertion on ties. Returns false if neither is in the box */
+static inline bool
+greedy_step(int64_t *trace, Box *box, int64_t d, int64_t k, bool *down, int64_t *x) {
+  int64_t x_down = -1, x_right = -1;
+
+  if(k + 1 <= d - 1 && TRACE(d - 1, k + 1) >= 0 && TRACE(d - 1, k + 1) - k <= BOX_HEIGHT(box)) {
+    x_down = TRACE(d - 1, k + 1);
+  }
+  if(k - 1 >= -(d - 1) && TRACE(d - 1, k - 1) >= 0 && TRACE(d - 1, k - 1) + 1 <= BOX_WIDTH(box)) {
+    x_right = TRACE(d - 1, k - 1) + 1;
+  }
+  if(x_down < 0 && x_right < 0) return false;
+
+  *down = x_down >= x_right;
+  *x = *down ? x_down : x_right;
+  return true;
+}
+
+/* The classic forward-only Myers search, for boxes known to differ in
+   only a few tokens. It scans every diagonal once, where bisecting the
+   box scans them again on each level below, but keeps the frontier of
+   every step to read the path back. Appends the points of the path from
+   corner to corner, or nothing if the distance turns out above max_d */
+static bool
+find_path_greedy(DiffEngine *engine, Box *box, int64_t max_d) {
+  int64_t width = BOX_WIDTH(box);
+  int64_t height = BOX_HEIGHT(box);
+  TokenId *ids_old = engine->ids_old_ + box->left;
+  TokenId *ids_new = engine->ids_new_ + box->top;
+  int64_t *trace = v_scratch_reserve(engine->ws, (size_t) ((max_d + 1) * (max_d + 1)));
+  int64_t distance = -1;
+
+  for(int64_t d = 0; d <= max_d && distance < 0; d++) {
+    if(engine->interrupted) return false;
+
+    for(int64_t k = -d; k <= d; k += 2) {
+      int64_t x = 0;
+      bool down = false;
+
+      if(d > 0 && !greedy_step(trace, box, d, k, &down, &x)) {
+        TRACE(d, k) = -1;
+        continue;
+      }
+
+      int64_t y = x - k;
+      while(x < width && y < height && ids_old[x] == ids_new[y]) {
+        x++;
+        y++;
+      }
+      TRACE(d, k) = x;
+
+      if(x == width && y == height) {
+        distance = d;
+        break;
+      }
+    }
+  }
+  if(distance < 0) return false;
+
+  count_box(engine, distance);
+
+  // back from the far corner, the diagonal each step ended on
+  int64_t ks[GREEDY_MAX_D + 1];
+  ks[distance] = width - height;
+  for(int64_t d = distance; d > 0; d--) {
+    int64_t x = 0;
+    bool down = false;
+    greedy_step(trace, box, d, ks[d], &down, &x);
+    ks[d - 1] = down ? ks[d] + 1 : ks[d] - 1;
+  }
+
+  // a point at the end of each snake, so one edit lies between two points
+  path_array_push_point(engine, box->left, box->top);
+  for(int64_t d = 0; d <= distance; d++) {
+    int64_t x = TRACE(d, ks[d]);
+    if(d == 0 && x == 0) continue;
+    path_array_push_point(engine, box->left + x, box->top + x - ks[d]);
+  }
+
+  return true;
+}
+
+#undef TRACE
+
+/* Divide and conquer over an explicit stack instead of recursion.
+   The right half is pushed before the left one, so boxes are finished
+   in order and their points can simply be appended to the path array.
+   Stops once the path array holds max_len points, the points found so far
+   are final and the search can be resumed by calling it again. An
+   interrupted box is put back on the stack for the same reason */
+static void
+find_path_step(DiffEngine *engine, uint32_t max_len) {
+  PathFrameStack *stack = &engine->ws->path_frames;
+  PathArray *path_array = &engine->ws->path_array;
+
+  while(stack->len > 0 && path_array->len < max_len) {
+    if(engine->interrupted) {
+      return;
+    }
+
+    stack->len--;
+    PathFrame frame = stack->data[stack->len];
+    Snake snake;
+    int64_t d;
+
+    /* The whole box is tried too. When its distance is larger, the
+       GREEDY_MAX_D + 1 steps scanned are lost, which on 90k tokens was
+       below the run to run noise of diff_bench */
+    if(frame.max_d <= GREEDY_MAX_D && BOX_SIZE((&frame.box)) > 0 &&
+       find_path_greedy(engine, &frame.box, MIN(frame.max_d, engine->max_cost))) {
+      continue;
+    }
+
+    if(!midpoint(engine, &frame.box, &snake, &d)) {
+      if(engine->interrupted) {
+        stack->len++;
+        return;
+      }
+      if(frame.has_point) {
+        path_array_push_point(engine, frame.x, frame.y);
+      }
+      continue;
+    }
+
+    int64_t start_x = snake.x1, start_y = snake.y1, finish_x = snake.x2, finish_y = snake.y2;
+
+    assert(!(start_x == frame.box.right && start_y == frame.box.bottom));
+
+    path_frame_stack_push(stack, (PathFrame) {
+      .box = {
+        .left = finish_x,
+        .top = finish_y,
+        .right = frame.box.right,
+        .bottom = frame.box.bottom
+      },
+      .x = finish_x,
+      .y = finish_y,
+      .has_point = true,
+      .max_d = d,
+    });
+
+    path_frame_stack_push(stack, (PathFrame) {
+      .box = {
+        .left = frame.box.left,
+        .top = frame.box.top,
+        .right = start_x,
+        .bottom = start_y
+      },
+      .x = start_x,
+      .y = start_y,
+      .has_point = true,
+      .max_d = d,
+    });
+  }
+}
+
+static bool
+find_path(DiffEngine *engine, int64_t left, int64_t top, int64_t right, int64_t bottom) {
+  find_path_init(engine, left, top, right, bottom);
+  find_path_step(engine, UINT32_MAX);
+  return !engine->interrupted && engine->ws->path_array.len > 0;
+}
+
+static void
+record_edit(DiffEngine *engine, CallbackType type, uint32_t old_idx, uint32_t new_idx) {
+  EditScript *script = &engine->edit_script;
+
+  if(engine->stats != NULL && type != CALLBACK_EQ) {
+    engine->stats->distance++;
+  }
+
+  if(script->len > 0) {
+    EditOp *last = &script->data[script->len - 1];
+    if(last->type == type &&
+       (type == CALLBACK_INS || last->old_idx + last->len == old_idx) &&
+       (type == CALLBACK_DEL || last->new_idx + last->len == new_idx)) {
+      last->len++;
+      return;
+    }
+  }
+
+  edit_script_push(script, (EditOp) {
+    .old_idx = old_idx,
+    .new_idx = new_idx,
+    .len = 1,
+    .type = type,
+  });
+}
+
+// Records the edit from (x1, y1) to (x2, y2), indexed from the untrimmed ids
+static void
+emit_edit(DiffEngine *engine, int64_t x1, int64_t y1, int64_t x2, int64_t y2) {
+  uint32_t old_idx = (uint32_t) (engine->prefix_len + x1);
+  uint32_t new_idx = (uint32_t) (engine->prefix_len + y1);
+
+  if(x1 == x2) {
+    record_edit(engine, CALLBACK_INS, 0, new_idx);
+  } else if(y1 == y2) {
+    record_edit(engine, CALLBACK_DEL, old_idx, 0);
+  } else {
+    record_edit(engine, CALLBACK_EQ, old_idx, new_idx);
+  }
+}
+
+static void
+walk_diagonal(DiffEngine *engine, int64_t x1, int64_t y1, int64_t x2, int64_t y2, int64_t *out_x1, int64_t *out_y1) {
+  while(x1 < x2 && y1 < y2 && engine->ids_old_[x1] == engine->ids_new_[y1]) {
+    emit_edit(engine, x1, y1, x1 + 1, y1 + 1);
+    x1++;
+    y1++;
+  }
+  *out_x1 = x1;
+  *out_y1 = y1;
+}
+
+// static void
+// free_path(Path *path) {
+//   if(path->next != NULL) {
+//     free_path(path->next);
+//   }
+//   xfree(path);
+// }
+
+/* Walks the edits between the points of the path array, keeping
+   only the last point to continue from when more points are found */
+static void
+walk_path(DiffEngine *engine) {
+  PathArray *path_array = &engine->ws->path_array;
+  if(path_array->len == 0) return;
+
+  Path *first = path_array_get(path_array, 0);
+  int64_t x1 = first->x, y1 = first->y;
+
+  for(PathIdx path_idx = 1; path_idx < path_array->len; path_idx++) {
+    Path *path = path_array_get(path_array, path_idx);
+    int64_t x2 = path->x, y2 = path->y;
+
+    walk_diagonal(engine, x1, y1, x2, y2, &x1, &y1);
+    int64_t d = (x2 - x1) - (y2 - y1);
+    if(d < 0) {
+      emit_edit(engine, x1, y1, x1, y1 + 1);
+      y1++;
+    } else if(d > 0) {
+      emit_edit(engine, x1, y1, x1 + 1, y1);
+      x1++;
+    }
+    walk_diagonal(engine, x1, y1, x2, y2, &x1, &y1);
+
+    x1 = x2;
+    y1 = y2;
+  }
+
+  path_array->data[0] = path_array->data[path_array->len - 1];
+  path_array->len = 1;
+}
+
+static void 
+walk_snakes(DiffEngine *engine, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new) {
+  if(!find_path(engine, start_old, start_new, end_old, end_new)) return;
+  walk_path(engine);
+}
+
+typedef enum {
+  RANGE_FRAME_DIFF,
+  RANGE_FRAME_EQ,
+} RangeFrameType;
+
+// A range still to be diffed, or a run of equal tokens to be emitted
+typedef struct {
+  Box box;
+  RangeFrameType type;
+} RangeFrame;
+
+typedef struct {
+  RangeFrame *data;
+  uint32_t len;
+  uint32_t capa;
+} RangeFrameStack;
+
+typedef struct {
+  uint32_t x;
+  uint32_t y;
+} Anchor;
+
+static void
+range_frame_stack_push(RangeFrameStack *stack, RangeFrameType type, int64_t left, int64_t right, int64_t top, int64_t bottom) {
+  if(!(stack->len < stack->capa)) {
+    uint32_t new_capa = 2 * stack->capa;
+    ENGINE_REALLOC_N(stack->data, RangeFrame, new_capa);
+    stack->capa = new_capa;
+  }
+  stack->data[stack->len] = (RangeFrame) {
+    .box = {
+      .left = left,
+      .right = right,
+      .top = top,
+      .bottom = bottom
+    },
+    .type = type,
+  };
+  stack->len++;
+}
+
+static void
+range_frame_stack_init(RangeFrameStack *stack, uint32_t capa) {
+  stack->data = ENGINE_ALLOC_N(RangeFrame, capa);
+  stack->capa = capa;
+  stack->len = 0;
+}
+
+static void
+range_frame_stack_destroy(RangeFrameStack *stack) {
+  ENGINE_FREE(stack->data);
+}
+
+static void
+walk_equal(DiffEngine *engine, int64_t x, int64_t y, int64_t len) {
+  if(len <= 0) return;
+
+  // the first token opens or extends an EQ run, the rest only lengthen it
+  emit_edit(engine, x, y, x + 1, y + 1);
+  engine->edit_script.data[engine->edit_script.len - 1].len += (uint32_t) (len - 1);
+}
+
+/* Walks the common prefix of the box right away and defers its common
+   suffix onto the stack, leaving only the differing middle in box */
+static void
+trim_box(DiffEngine *engine, RangeFrameStack *stack, Box *box) {
+  while(box->left < box->right && box->top < box->bottom && engine->ids_old_[box->left] == engine->ids_new_[box->top]) {
+    emit_edit(engine, box->left, box->top, box->left + 1, box->top + 1);
+    box->left++;
+    box->top++;
+  }
+
+  int64_t suffix_len = 0;
+  while(box->left < box->right - suffix_len && box->top < box->bottom - suffix_len &&
+        engine->ids_old_[box->right - suffix_len - 1] == engine->ids_new_[box->bottom - suffix_len - 1]) {
+    suffix_len++;
+  }
+
+  if(suffix_len > 0) {
+    box->right -= suffix_len;
+    box->bottom -= suffix_len;
+    range_frame_stack_push(stack, RANGE_FRAME_EQ, box->right, box->right + suffix_len, box->bottom, box->bottom + suffix_len);
+  }
+}
+
+/* Sizes the tables by token id of patience and histogram for ids below
+   distinct_ids. They are kept across boxes and diffs: between uses all
+   counts are 0 and all heads UINT32_MAX, so a box only resets the ids it
+   touched and costs time in its size rather than in the number of ids */
+static void
+id_tables_reserve(DiffWorkspace *ws, uint32_t distinct_ids) {
+  size_t capa = ws->id_tables_capa;
+  if(distinct_ids <= capa) return;
+
+  size_t new_capa = MAX((size_t) distinct_ids, 2 * capa);
+  // patience counts both sides, the new ones after the old
+  ENGINE_REALLOC_N(ws->id_counts, uint32_t, 2 * new_capa);
+  ENGINE_REALLOC_N(ws->id_heads, uint32_t, new_capa);
+  ENGINE_REALLOC_N(ws->id_positions, uint32_t, new_capa);
+  memset(ws->id_counts + 2 * capa, 0, 2 * (new_capa - capa) * sizeof(uint32_t));
+  memset(ws->id_heads + capa, 0xff, (new_capa - capa) * sizeof(uint32_t));
+  ws->id_tables_capa = new_capa;
+}
+
+/* Finds the tokens occurring exactly once on either side of the box
+   and returns the longest chain of them that is in order on both sides */
+static uint32_t
+patience_anchors(DiffEngine *engine, Box *box, uint32_t *counts, uint32_t *positions, Anchor *anchors, uint32_t *lis) {
+  uint32_t *counts_old = counts;
+  uint32_t *counts_new = counts + engine->distinct_ids;
+  uint32_t anchors_len = 0;
+
+  for(int64_t x = box->left; x < box->right; x++) {
+    counts_old[engine->ids_old_[x]]++;
+  }
+
+  for(int64_t y = box->top; y < box->bottom; y++) {
+    TokenId id = engine->ids_new_[y];
+    counts_new[id]++;
+    positions[id] = (uint32_t) y;
+  }
+
+  for(int64_t x = box->left; x < box->right; x++) {
+    TokenId id = engine->ids_old_[x];
+    if(counts_old[id] == 1 && counts_new[id] == 1) {
+      anchors[anchors_len++] = (Anchor) {(uint32_t) x, positions[id]};
+    }
+  }
+
+  for(int64_t x = box->left; x < box->right; x++) {
+    counts_old[engine->ids_old_[x]] = 0;
+  }
+
+  for(int64_t y = box->top; y < box->bottom; y++) {
+    counts_new[engine->ids_new_[y]] = 0;
+  }
+
+  if(anchors_len == 0) return 0;
+
+  // patience sorting, lis[anchors_len + i] is the predecessor of anchor i
+  uint32_t *tails = lis;
+  uint32_t *prev = lis + anchors_len;
+  uint32_t tails_len = 0;
+
+  for(uint32_t i = 0; i < anchors_len; i++) {
+    uint32_t lo = 0, hi = tails_len;
+    while(lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if(anchors[tails[mid]].y < anchors[i].y) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    prev[i] = lo > 0 ? tails[lo - 1] : UINT32_MAX;
+    tails[lo] = i;
+    if(lo == tails_len) tails_len++;
+  }
+
+  uint32_t chain_len = 0;
+  for(uint32_t i = tails[tails_len - 1]; i != UINT32_MAX; i = prev[i]) {
+    lis[chain_len++] = i;
+  }
+
+  // the i-th anchor of the chain has an index >= i, so it can be compacted in place
+  for(uint32_t i = 0; i < chain_len; i++) {
+    anchors[i] = anchors[lis[chain_len - i - 1]];
+  }
+
+  return chain_len;
+}
+
+/* Patience diff: anchors on tokens unique to both sides,
+   recursing between the anchors and falling back to Myers for ranges without any */
+static void
+walk_patience(DiffEngine *engine, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new) {
+  uint32_t max_len = MAX(end_old - start_old, end_new - start_new);
+  DiffWorkspace *ws = engine->ws;
+  Anchor *anchors = ENGINE_ALLOC_N(Anchor, max_len);
+  uint32_t *lis = ENGINE_ALLOC_N(uint32_t, 2 * (size_t) max_len);
+  RangeFrameStack stack;
+
+  id_tables_reserve(ws, engine->distinct_ids);
+  range_frame_stack_init(&stack, 64);
+  range_frame_stack_push(&stack, RANGE_FRAME_DIFF, start_old, end_old, start_new, end_new);
+
+  while(stack.len > 0 && !engine->interrupted) {
+    stack.len--;
+    RangeFrame frame = stack.data[stack.len];
+    Box box = frame.box;
+
+    if(frame.type == RANGE_FRAME_EQ) {
+      walk_equal(engine, box.left, box.top, BOX_WIDTH((&box)));
+      continue;
+    }
+
+    trim_box(engine, &stack, &box);
+
+    uint32_t anchors_len = 0;
+    if(box.left < box.right && box.top < box.bottom) {
+      anchors_len = patience_anchors(engine, &box, ws->id_counts, ws->id_positions, anchors, lis);
+    }
+
+    if(anchors_len == 0) {
+      walk_snakes(engine, box.left, box.right, box.top, box.bottom);
+      continue;
+    }
+
+    // pushed back to front, so that the ranges are walked in order
+    int64_t right = box.right, bottom = box.bottom;
+    for(uint32_t i = anchors_len; i-- > 0;) {
+      Anchor *anchor = &anchors[i];
+      range_frame_stack_push(&stack, RANGE_FRAME_DIFF, anchor->x + 1, right, anchor->y + 1, bottom);
+      range_frame_stack_push(&stack, RANGE_FRAME_EQ, anchor->x, anchor->x + 1, anchor->y, anchor->y + 1);
+      right = anchor->x;
+      bottom = anchor->y;
+    }
+    range_frame_stack_push(&stack, RANGE_FRAME_DIFF, box.left, right, box.top, bottom);
+  }
+
+  range_frame_stack_destroy(&stack);
+  ENGINE_FREE(lis);
+  ENGINE_FREE(anchors);
+}
+
+#define HISTOGRAM_MAX_CHAIN 64
+#define HISTOGRAM_MYERS_THRESHOLD 32
+
+// Occurrences of the old tokens in a range, bucketed by token id
+typedef struct {
+  uint32_t *heads;
+  uint32_t *counts;
+  uint32_t *chain;
+} HistogramIndex;
+
+/* Finds the longest run of equal tokens in the box built from the least
+   frequent old tokens, as in git's histogram diff. Returns false if the
+   box has no common token occurring less than HISTOGRAM_MAX_CHAIN times */
+static bool
+histogram_lcs(DiffEngine *engine, Box *box, HistogramIndex *index, Box *lcs) {
+  TokenId *ids_old = engine->ids_old_;
+  TokenId *ids_new = engine->ids_new_;
+
+  // built back to front, so that chains run in ascending order
+  for(int64_t x = box->right; x-- > box->left;) {
+    TokenId id = ids_old[x];
+    index->chain[x] = index->heads[id];
+    index->heads[id] = (uint32_t) x;
+    index->counts[id]++;
+  }
+
+  uint32_t best_count = HISTOGRAM_MAX_CHAIN;
+  int64_t best_len = 0;
+
+  for(int64_t y = box->top; y < box->bottom;) {
+    TokenId id = ids_new[y];
+    int64_t next_y = y + 1;
+
+    if(index->counts[id] == 0 || index->counts[id] > best_count) {
+      y = next_y;
+      continue;
+    }
+
+    for(uint32_t x = index->heads[id]; x != UINT32_MAX; x = index->chain[x]) {
+      int64_t start_x = x, start_y = y, end_x = x + 1, end_y = y + 1;
+      uint32_t count = index->counts[id];
+
+      while(start_x > box->left && start_y > box->top && ids_old[start_x - 1] == ids_new[start_y - 1]) {
+        start_x--;
+        start_y--;
+        count = MIN(count, index->counts[ids_old[start_x]]);
+      }
+
+      while(end_x < box->right && end_y < box->bottom && ids_old[end_x] == ids_new[end_y]) {
+        count = MIN(count, index->counts[ids_old[end_x]]);
+        end_x++;
+        end_y++;
+      }
+
+      next_y = MAX(next_y, end_y);
+
+      if(best_len < end_x - start_x || count < best_count) {
+        *lcs = (Box) {
+          .left = start_x,
+          .right = end_x,
+          .top = start_y,
+          .bottom = end_y
+        };
+        best_len = end_x - start_x;
+        best_count = count;
+      }
+    }
+
+    y = next_y;
+  }
+
+  for(int64_t x = box->left; x < box->right; x++) {
+    TokenId id = ids_old[x];
+    index->heads[id] = UINT32_MAX;
+    index->counts[id] = 0;
+  }
+
+  return best_len > 0;
+}
+
+/* Histogram diff: splits ranges at the longest run anchored on rare tokens,
+   so that frequent tokens such as `end` or `}` never drive the search.
+   Small ranges, and ranges without rare tokens, are left to Myers */
+static void
+walk_histogram(DiffEngine *engine, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new) {
+  DiffWorkspace *ws = engine->ws;
+  HistogramIndex index;
+  RangeFrameStack stack;
+
+  id_tables_reserve(ws, engine->distinct_ids);
+  if(end_old > ws->histogram_chain_capa) {
+    ENGINE_REALLOC_N(ws->histogram_chain, uint32_t, end_old);
+    ws->histogram_chain_capa = end_old;
+  }
+  index.heads = ws->id_heads;
+  index.counts = ws->id_counts;
+  index.chain = ws->histogram_chain;
+
+  range_frame_stack_init(&stack, 64);
+  range_frame_stack_push(&stack, RANGE_FRAME_DIFF, start_old, end_old, start_new, end_new);
+
+  while(stack.len > 0 && !engine->interrupted) {
+    stack.len--;
+    RangeFrame frame = stack.data[stack.len];
+    Box box = frame.box;
+    Box lcs = {0, };
+
+    if(frame.type == RANGE_FRAME_EQ) {
+      walk_equal(engine, box.left, box.top, BOX_WIDTH((&box)));
+      continue;
+    }
+
+    trim_box(engine, &stack, &box);
+
+    if(BOX_WIDTH((&box)) == 0 || BOX_HEIGHT((&box)) == 0 || BOX_SIZE((&box)) < HISTOGRAM_MYERS_THRESHOLD ||
+       !histogram_lcs(engine, &box, &index, &lcs)) {
+      walk_snakes(engine, box.left, box.right, box.top, box.bottom);
+      continue;
+    }
+
+    range_frame_stack_push(&stack, RANGE_FRAME_DIFF, lcs.right, box.right, lcs.bottom, box.bottom);
+    range_frame_stack_push(&stack, RANGE_FRAME_EQ, lcs.left, lcs.right, lcs.top, lcs.bottom);
+    range_frame_stack_push(&stack, RANGE_FRAME_DIFF, box.left, lcs.left, box.top, lcs.top);
+  }
+
+  range_frame_stack_destroy(&stack);
+}
+
+static void
+walk_tokens(DiffEngine *engine, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new) {
+  switch(engine->algorithm) {
+    case DIFF_ALGORITHM_PATIENCE:
+      walk_patience(engine, start_old, end_old, start_new, end_new);
+      break;
+    case DIFF_ALGORITHM_HISTOGRAM:
+      walk_histogram(engine, start_old, end_old, start_new, end_new);
+      break;
+    case DIFF_ALGORITHM_MYERS:
+    default:
+      walk_snakes(engine, start_old, end_old, start_new, end_new);
+      break;
+  }
+}
+
+#define LINE_HASH_SEED 0xcbf29ce484222325ULL
+#define LINE_HASH_MUL 0x100000001b3ULL
+
+typedef struct {
+  TokenId *ids;
+  uint32_t len;
+  uint64_t hash;
+} LineDictEntry;
+
+static uint64_t
+line_hash(TokenId *ids, uint32_t len) {
+  uint64_t hash = LINE_HASH_SEED;
+  for(uint32_t i = 0; i < len; i++) {
+    hash = (hash ^ ids[i]) * LINE_HASH_MUL;
+  }
+  return hash ^ (hash >> 29);
+}
+
+/* Maps the lines of both sides to dense ids by their token ids, like
+   intern_tokens does for tokens. Returns the number of distinct lines */
+static uint32_t
+intern_lines(DiffEngine *engine, TokenLine *lines_old, uint32_t lines_old_len, TokenId *line_ids_old,
+             TokenLine *lines_new, uint32_t lines_new_len, TokenId *line_ids_new) {
+  size_t capa = (size_t) lines_old_len + lines_new_len;
+  size_t buckets_len = 16;
+  while(buckets_len < 2 * capa) buckets_len *= 2;
+
+  LineDictEntry *entries = ENGINE_ALLOC_N(LineDictEntry, MAX(capa, 1));
+  uint32_t *buckets = ENGINE_ZALLOC_N(uint32_t, buckets_len);
+  uint32_t mask = (uint32_t) (buckets_len - 1);
+  uint32_t entries_len = 0;
+
+  for(int side = 0; side < 2; side++) {
+    TokenLine *lines = side == 0 ? lines_old : lines_new;
+    uint32_t lines_len = side == 0 ? lines_old_len : lines_new_len;
+    TokenId *ids = side == 0 ? engine->ids_old_ : engine->ids_new_;
+    TokenId *line_ids = side == 0 ? line_ids_old : line_ids_new;
+
+    for(uint32_t i = 0; i < lines_len; i++) {
+      TokenId *line = ids + lines[i].start;
+      uint32_t len = lines[i].len;
+      uint64_t hash = line_hash(line, len);
+      uint32_t bucket_idx = (uint32_t) hash & mask;
+
+      while(true) {
+        uint32_t bucket = buckets[bucket_idx];
+        if(bucket == 0) {
+          entries[entries_len] = (LineDictEntry) {
+            .ids = line,
+            .len = len,
+            .hash = hash,
+          };
+          buckets[bucket_idx] = entries_len + 1;
+          line_ids[i] = entries_len++;
+          break;
+        }
+
+        LineDictEntry *entry = &entries[bucket - 1];
+        if(entry->hash == hash && entry->len == len && !memcmp(entry->ids, line, len * sizeof(TokenId))) {
+          line_ids[i] = bucket - 1;
+          break;
+        }
+        bucket_idx = (bucket_idx + 1) & mask;
+      }
+    }
+  }
+
+  ENGINE_FREE(entries);
+  ENGINE_FREE(buckets);
+  return entries_len;
+}
+
+/* Diffs the lines first, then the tokens of each run of changed lines
+   only. Lines are compared as a whole, so the token level search is
+   confined to the edited regions, at the price of a less minimal diff
+   where a change moves tokens across lines */
+void
+diff_engine_walk_lines(DiffEngine *engine, TokenLine *lines_old, uint32_t lines_old_len,
+                       TokenLine *lines_new, uint32_t lines_new_len, uint32_t end_old, uint32_t end_new) {
+  TokenId *line_ids_old = ENGINE_ALLOC_N(TokenId, MAX(lines_old_len, 1));
+  TokenId *line_ids_new = ENGINE_ALLOC_N(TokenId, MAX(lines_new_len, 1));
+  uint32_t distinct_lines = intern_lines(engine, lines_old, lines_old_len, line_ids_old,
+                                         lines_new, lines_new_len, line_ids_new);
+
+  // the line level diff runs on line ids and records into a script of its own
+  EditScript token_script = engine->edit_script;
+  TokenId *ids_old = engine->ids_old_;
+  TokenId *ids_new = engine->ids_new_;
+  uint32_t distinct_ids = engine->distinct_ids;
+
+  edit_script_init(&engine->edit_script, 64);
+  engine->ids_old_ = line_ids_old;
+  engine->ids_new_ = line_ids_new;
+  engine->distinct_ids = distinct_lines;
+  uint64_t distance = engine->stats != NULL ? engine->stats->distance : 0;
+  walk_tokens(engine, 0, lines_old_len, 0, lines_new_len);
+  // the searched boxes count, the edits of whole lines do not
+  if(engine->stats != NULL) engine->stats->distance = distance;
+
+  EditScript line_script = engine->edit_script;
+  engine->edit_script = token_script;
+  engine->ids_old_ = ids_old;
+  engine->ids_new_ = ids_new;
+  engine->distinct_ids = distinct_ids;
+
+  uint32_t x = 0, y = 0;
+  uint32_t changed_x = 0, changed_y = 0;
+
+  for(uint32_t i = 0; i <= line_script.len && !engine->interrupted; i++) {
+    EditOp *op = i < line_script.len ? &line_script.data[i] : NULL;
+
+    if(op == NULL || op->type == CALLBACK_EQ) {
+      if(changed_x < x || changed_y < y) {
+        walk_tokens(engine, changed_x < lines_old_len ? lines_old[changed_x].start : end_old,
+                         x < lines_old_len ? lines_old[x].start : end_old,
+                         changed_y < lines_new_len ? lines_new[changed_y].start : end_new,
+                         y < lines_new_len ? lines_new[y].start : end_new);
+      }
+      if(op == NULL) break;
+
+      // the script indexes from the untrimmed ids
+      assert(op->old_idx - engine->prefix_len == x && op->new_idx - engine->prefix_len == y);
+      for(uint32_t j = 0; j < op->len; j++) {
+        walk_equal(engine, lines_old[x].start, lines_new[y].start, lines_old[x].len);
+        x++;
+        y++;
+      }
+      changed_x = x;
+      changed_y = y;
+    } else if(op->type == CALLBACK_DEL) {
+      x += op->len;
+    } else {
+      y += op->len;
+    }
+  }
+
+  edit_script_destroy(&line_script);
+  ENGINE_FREE(line_ids_old);
+  ENGINE_FREE(line_ids_new);
+}
+
+void
+diff_workspace_init(DiffWorkspace *ws) {
+  path_array_init(&ws->path_array, 512);
+  path_frame_stack_init(&ws->path_frames, 64);
+  ws->v_scratch = NULL;
+  ws->v_scratch_capa = 0;
+  ws->id_counts = NULL;
+  ws->id_heads = NULL;
+  ws->id_positions = NULL;
+  ws->id_tables_capa = 0;
+  ws->histogram_chain = NULL;
+  ws->histogram_chain_capa = 0;
+}
+
+void
+diff_workspace_destroy(DiffWorkspace *ws) {
+  path_array_destroy(&ws->path_array);
+  path_frame_stack_destroy(&ws->path_frames);
+  ENGINE_FREE(ws->v_scratch);
+  ENGINE_FREE(ws->id_counts);
+  ENGINE_FREE(ws->id_heads);
+  ENGINE_FREE(ws->id_positions);
+  ENGINE_FREE(ws->histogram_chain);
+}
+
+
+bool
+diff_engine_trim(DiffEngine *engine) {
+  ssize_t tokens_old_len = (ssize_t) engine->old_len;
+  ssize_t tokens_new_len = (ssize_t) engine->new_len;
+
+  ssize_t prefix_len = 0;
+  ssize_t tokens_min_len = MIN(tokens_old_len, tokens_new_len);
+  for(ssize_t i = 0; i < tokens_min_len; i++) {
+    if(engine->ids_old[i] != engine->ids_new[i]) break;
+    prefix_len = i + 1;
+  }
+
+  ssize_t suffix_len = 0;
+  for(ssize_t i = 0; tokens_old_len - i > prefix_len && tokens_new_len - i > prefix_len; i++) {
+    suffix_len = i;
+    if(engine->ids_old[tokens_old_len - i - 1] != engine->ids_new[tokens_new_len - i - 1]) break;
+  }
+
+  engine->prefix_len = prefix_len;
+  engine->suffix_len = suffix_len;
+
+  if(prefix_len == tokens_old_len && prefix_len == tokens_new_len) {
+    return false;
+  }
+
+  engine->ids_new_ = engine->ids_new + prefix_len;
+  engine->ids_old_ = engine->ids_old + prefix_len;
+  return true;
+}
+
+bool
+diff_engine_diff(DiffEngine *engine) {
+  engine->edit_script.len = 0;
+  if(!diff_engine_trim(engine)) return false;
+
+  walk_tokens(engine, 0, engine->old_len - engine->suffix_len - engine->prefix_len,
+                      0, engine->new_len - engine->suffix_len - engine->prefix_len);
+  return true;
+}
+
+void
+diff_engine_walk(DiffEngine *engine, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new) {
+  walk_tokens(engine, start_old, end_old, start_new, end_new);
+}
+
+void
+diff_engine_walk_equal(DiffEngine *engine, int64_t x, int64_t y, int64_t len) {
+  walk_equal(engine, x, y, len);
+}
+
+void
+diff_engine_find_path_init(DiffEngine *engine, int64_t left, int64_t top, int64_t right, int64_t bottom) {
+  find_path_init(engine, left, top, right, bottom);
+}
+
+void
+diff_engine_find_path_step(DiffEngine *engine, uint32_t max_len) {
+  find_path_step(engine, max_len);
+}
+
+void
+diff_engine_walk_path(DiffEngine *engine) {
+  walk_path(engine);
+}
+
+int64_t
+diff_engine_distance(DiffEngine *engine, int64_t max) {
+  Box box = {
+    .left = 0,
+    .right = (int64_t) engine->old_len - engine->suffix_len - engine->prefix_len,
+    .top = 0,
+    .bottom = (int64_t) engine->new_len - engine->suffix_len - engine->prefix_len,
+  };
+  return box_distance(engine, &box, max);
+}
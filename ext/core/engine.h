@@ -0,0 +1,196 @@
+#pragma once
+
+/*
+The diff engine proper, free of any Ruby: tokens come in as arrays of
+interned ids, edits go out as a run-length edit script. The extension
+tokenizes, interns and turns the script into change sets around it.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#ifndef MAX
+#define MAX(a,b) (((a)<(b))?(b):(a))
+#endif
+
+#ifndef MIN
+#define MIN(a,b) (((a)>(b))?(b):(a))
+#endif
+
+/* Allocations of the engine, malloc and friends aborting when out of
+   memory. Unlike Ruby's xmalloc they work on any thread, so the extension
+   also uses them for whatever it allocates while a search runs */
+void *diff_engine_check_alloc(void *ptr, size_t size);
+
+#define ENGINE_ALLOC_N(type, n) ((type *) diff_engine_check_alloc(malloc(sizeof(type) * (size_t) (n)), sizeof(type) * (size_t) (n)))
+#define ENGINE_ZALLOC_N(type, n) ((type *) diff_engine_check_alloc(calloc((size_t) (n), sizeof(type)), sizeof(type) * (size_t) (n)))
+#define ENGINE_REALLOC_N(var, type, n) ((var) = (type *) diff_engine_check_alloc(realloc((var), sizeof(type) * (size_t) (n)), sizeof(type) * (size_t) (n)))
+#define ENGINE_FREE(ptr) free(ptr)
+
+typedef struct Path {
+  int64_t x;
+  int64_t y;
+} Path;
+
+typedef uint32_t PathIdx;
+
+typedef struct {
+  Path *data;
+  uint32_t len;
+  uint32_t capa;
+} PathArray;
+
+typedef struct {
+  int64_t left;
+  int64_t right;
+  int64_t top;
+  int64_t bottom;
+} Box;
+
+#define BOX_WIDTH(b) (b->right - b->left)
+#define BOX_HEIGHT(b) (b->bottom - b->top)
+#define BOX_SIZE(b) (BOX_WIDTH(b) + BOX_HEIGHT(b))
+#define BOX_DELTA(b) (BOX_WIDTH(b) - BOX_HEIGHT(b))
+
+typedef struct {
+  int64_t x1;
+  int64_t y1;
+  int64_t x2;
+  int64_t y2;
+} Snake;
+
+// A box still to be bisected by find_path(),
+// plus the point that stands in for it if it holds no snake
+typedef struct {
+  Box box;
+  int64_t x;
+  int64_t y;
+  bool has_point;
+  // bound on the distance of the box, from the step its parent was split at
+  int64_t max_d;
+} PathFrame;
+
+typedef struct {
+  PathFrame *data;
+  uint32_t len;
+  uint32_t capa;
+} PathFrameStack;
+
+// Tokens with equal contents have equal ids
+typedef uint32_t TokenId;
+
+typedef enum {
+  CALLBACK_START,
+  CALLBACK_FINISH,
+  CALLBACK_EQ,
+  CALLBACK_INS,
+  CALLBACK_DEL,
+} CallbackType;
+
+// Run of consecutive edits of the same type, recorded by the search
+// and replayed by the caller afterwards
+typedef struct {
+  uint32_t old_idx;
+  uint32_t new_idx;
+  uint32_t len;
+  uint8_t type;
+} EditOp;
+
+typedef struct {
+  EditOp *data;
+  uint32_t len;
+  uint32_t capa;
+} EditScript;
+
+typedef enum {
+  DIFF_ALGORITHM_MYERS,
+  DIFF_ALGORITHM_PATIENCE,
+  DIFF_ALGORITHM_HISTOGRAM,
+} DiffAlgorithm;
+
+// Buffers used by the search only, reused across diffs run on the same thread
+typedef struct {
+  PathArray path_array;
+  PathFrameStack path_frames;
+  int64_t *v_scratch;
+  size_t v_scratch_capa;
+  // tables by token id of patience and histogram, see id_tables_reserve
+  uint32_t *id_counts;
+  uint32_t *id_heads;
+  uint32_t *id_positions;
+  size_t id_tables_capa;
+  uint32_t *histogram_chain;
+  size_t histogram_chain_capa;
+} DiffWorkspace;
+
+// A run of tokens ending with one before a newline, the unit of the line level diff
+typedef struct {
+  uint32_t start;
+  uint32_t len;
+} TokenLine;
+
+// Counters of the search, kept only when DiffEngine.stats is set
+typedef struct {
+  // boxes bisected by a midpoint search, the recursion count
+  uint64_t boxes;
+  // furthest d reached by a midpoint search
+  int64_t max_d;
+  uint32_t max_path_len;
+  // inserted plus deleted ids
+  uint64_t distance;
+} DiffStats;
+
+/* One diff of ids_old against ids_new. The caller fills in the ids, the
+   options and a workspace; the edits are appended to edit_script with
+   indexes into the untrimmed ids. Counters go to stats unless it is
+   NULL. Setting interrupted, from any thread,
+   makes the search return early with an incomplete script */
+typedef struct DiffEngine {
+  TokenId *ids_old;
+  TokenId *ids_new;
+  size_t old_len;
+  size_t new_len;
+  uint32_t distinct_ids;
+  DiffAlgorithm algorithm;
+  int64_t max_cost;
+  DiffWorkspace *ws;
+  EditScript edit_script;
+  ssize_t prefix_len;
+  ssize_t suffix_len;
+  // the ids without the common prefix, which is what the search indexes
+  TokenId *ids_old_;
+  TokenId *ids_new_;
+  DiffStats *stats;
+  volatile bool interrupted;
+} DiffEngine;
+
+void diff_workspace_init(DiffWorkspace *ws);
+void diff_workspace_destroy(DiffWorkspace *ws);
+
+void edit_script_init(EditScript *script, uint32_t capa);
+void edit_script_destroy(EditScript *script);
+
+// Strips the common prefix and suffix, returns false if nothing is left
+bool diff_engine_trim(DiffEngine *engine);
+
+// Trims and diffs all of the ids, returns false if they are equal
+bool diff_engine_diff(DiffEngine *engine);
+
+/* The building blocks of diff_engine_diff, for callers that pick the
+   boxes to search themselves. Coordinates are relative to the prefix */
+void diff_engine_walk(DiffEngine *engine, uint32_t start_old, uint32_t end_old, uint32_t start_new, uint32_t end_new);
+void diff_engine_walk_equal(DiffEngine *engine, int64_t x, int64_t y, int64_t len);
+void diff_engine_walk_lines(DiffEngine *engine, TokenLine *lines_old, uint32_t lines_old_len,
+                            TokenLine *lines_new, uint32_t lines_new_len, uint32_t end_old, uint32_t end_new);
+
+/* A Myers search run in steps: each step finds up to max_len points of
+   the path and walk_path records the edits between them */
+void diff_engine_find_path_init(DiffEngine *engine, int64_t left, int64_t top, int64_t right, int64_t bottom);
+void diff_engine_find_path_step(DiffEngine *engine, uint32_t max_len);
+void diff_engine_walk_path(DiffEngine *engine);
+
+// Edit distance of the trimmed ids, -1 once it exceeds max
+int64_t diff_engine_distance(DiffEngine *engine, int64_t max);
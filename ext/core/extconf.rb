@@ -1,7 +1,38 @@
 require 'mkmf'
 
 $INCFLAGS << ' -I$(srcdir)/vendor/include'
-CONFIG['debugflags'] << ' -ggdb3 -O0'
-#CONFIG['debugflags'] << ' -ggdb3'
+
+# TREE_SITTER_DIFF_DEBUG=1 builds unoptimized, with assertions
+if ENV['TREE_SITTER_DIFF_DEBUG']
+  CONFIG['debugflags'] << ' -ggdb3 -O0'
+else
+  CONFIG['optflags'] = '-O3'
+  $defs << '-DNDEBUG'
+
+  # LTO across core.c and engine.c, if the toolchain has it
+  lto = %w[-flto=auto -flto].find { |flag| try_cflags(flag) && try_ldflags(flag) }
+  if lto
+    $CFLAGS << " #{lto}"
+    $DLDFLAGS << " #{lto}"
+  end
+
+  # TREE_SITTER_DIFF_PGO=generate builds an instrumented extension that
+  # writes profiles to TREE_SITTER_DIFF_PGO_DIR, =use builds with them.
+  # rake pgo runs both, training on bench/corpus
+  pgo_dir = File.expand_path(ENV.fetch('TREE_SITTER_DIFF_PGO_DIR', '../../tmp/pgo'), __dir__)
+  case ENV['TREE_SITTER_DIFF_PGO']
+  when 'generate'
+    $CFLAGS << " -fprofile-generate=#{pgo_dir}"
+    $DLDFLAGS << " -fprofile-generate=#{pgo_dir}"
+  when 'use'
+    abort "no profiles in #{pgo_dir}, run with TREE_SITTER_DIFF_PGO=generate first" unless Dir.exist?(pgo_dir)
+    $CFLAGS << " -fprofile-use=#{pgo_dir} -fprofile-correction"
+    $CFLAGS << ' -Wno-missing-profile' if try_cflags('-Wno-missing-profile')
+    $DLDFLAGS << " -fprofile-use=#{pgo_dir}"
+  when nil, ''
+  else
+    abort "TREE_SITTER_DIFF_PGO must be generate or use, got #{ENV['TREE_SITTER_DIFF_PGO']}"
+  end
+end
 
 create_makefile('core')
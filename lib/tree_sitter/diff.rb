@@ -6,8 +6,59 @@ require_relative 'diff/core'
 
 module TreeSitter
   module Diff
-    def self.diff(old, new, output_equal: false, output_replace: false, ignore_whitespace: true, ignore_comments: false)
-      __diff__ old, new, output_equal, output_replace, ignore_whitespace, ignore_comments
+    # Change types in the order of the type field of diff_ranges records
+    CHANGE_TYPES = %i[+ - = !].freeze
+
+    # With stats: true, last_stats returns the token counts, trimmed lengths,
+    # search counters and phase timings (ns) of the diff afterwards.
+    # edits: takes the [start_byte, old_end_byte, new_end_byte] given to
+    # Tree#edit and searches only around them; it cannot be combined with
+    # anchor_subtrees or split_lines, and those two exclude each other too.
+    def self.diff(old, new, output_equal: false, output_replace: false, ignore_whitespace: true, ignore_comments: false, algorithm: :myers, max_cost: nil, anchor_subtrees: false, edits: nil, split_lines: false, stats: false)
+      __diff__ old, new, output_equal, output_replace, ignore_whitespace, ignore_comments, algorithm, max_cost, anchor_subtrees, edits, split_lines, stats
+    end
+
+    # The change sets as a binary String of native-endian uint32 records
+    # (type, old_start, old_end, new_start, new_end), see CHANGE_TYPES.
+    # An empty side is given as the byte offset it applies at.
+    def self.diff_ranges(old, new, output_equal: false, output_replace: false, ignore_whitespace: true, ignore_comments: false, algorithm: :myers, max_cost: nil, anchor_subtrees: false, edits: nil, split_lines: false, stats: false)
+      __diff_ranges__ old, new, output_equal, output_replace, ignore_whitespace, ignore_comments, algorithm, max_cost, anchor_subtrees, edits, split_lines, stats
+    end
+
+    def self.render(change_sets, context: 3)
+      __render__ change_sets, context
+    end
+
+    def self.each_change(old, new, output_equal: false, output_replace: false, ignore_whitespace: true, ignore_comments: false, algorithm: :myers, max_cost: nil, anchor_subtrees: false, edits: nil, split_lines: false, stats: false, &block)
+      unless block
+        return enum_for(__method__, old, new, output_equal: output_equal, output_replace: output_replace,
+                        ignore_whitespace: ignore_whitespace, ignore_comments: ignore_comments,
+                        algorithm: algorithm, max_cost: max_cost, anchor_subtrees: anchor_subtrees, edits: edits, split_lines: split_lines, stats: stats)
+      end
+
+      __each_change__ old, new, output_equal, output_replace, ignore_whitespace, ignore_comments, algorithm, max_cost, anchor_subtrees, edits, split_lines, stats, &block
+    end
+
+    def self.distance(old, new, max: nil, ignore_whitespace: true, ignore_comments: false, stats: false)
+      __distance__ old, new, max, ignore_whitespace, ignore_comments, stats
+    end
+
+    # Either node may be a TokenizedTree, which spares tokenizing it again
+    # just to locate its tree-sitter node
+    def self.pq_gram_distance(node_a, node_b, p: 2, q: 3, named_only: true)
+      __pq_gram_distance__ node_a, node_b, p, q, named_only
+    end
+
+    def self.diff_many(pairs, threads: nil, output_equal: false, output_replace: false, ignore_whitespace: true, ignore_comments: false, algorithm: :myers, max_cost: nil, anchor_subtrees: false, split_lines: false)
+      __diff_many__ pairs, threads, output_equal, output_replace, ignore_whitespace, ignore_comments, algorithm, max_cost, anchor_subtrees, split_lines
+    end
+
+    # The tokens of a node, to be passed to diff and friends in place of the
+    # node when it is diffed more than once
+    class TokenizedTree
+      def self.new(node, ignore_whitespace: true, ignore_comments: false)
+        __new__ node, ignore_whitespace, ignore_comments
+      end
     end
 
     class ChangeSet
@@ -17,8 +68,10 @@ module TreeSitter
         "#<#{self.class} #{type} [#{peek}#{size > peek_size ? ', ...' : ''}]>"
       end
 
-      def pq_profile(p, q, profile = nil, include_root_ancestors: true, raw: false, pairs: false, named_only: true, max_depth: 3)
-        __pq_profile__(p, q, profile, include_root_ancestors, raw, pairs, named_only, max_depth)
+      # packed: true returns the sorted 64-bit little-endian fingerprints of
+      # the grams as a binary String, hashed like pq_gram_distance's
+      def pq_profile(p, q, profile = nil, include_root_ancestors: true, raw: false, pairs: false, named_only: true, max_depth: 3, packed: false)
+        __pq_profile__(p, q, profile, include_root_ancestors, raw, pairs, named_only, max_depth, packed)
       end
     end
   end
@@ -1,6 +1,42 @@
 # frozen_string_literal: true
 
 $LOAD_PATH.unshift File.expand_path("../lib", __dir__)
-require "tokdiff"
+require "tree_sitter/diff"
 
 require "minitest/autorun"
+
+module DiffTestHelper
+  # Sources are written with a space around every token, so that the
+  # tokens are the same whatever the grammar does with punctuation
+  OLD_SOURCE = "int a = 1 ;\nint b = 2 ;\nint c = 3 ;\n"
+  NEW_SOURCE = "int a = 1 ;\nint b = 5 ;\nint c = 3 ;\n"
+
+  def parse(source, language = :c)
+    TreeSitter::Parser.new(language).parse(source).root_node
+  end
+
+  # The records of diff_ranges as [type, old text, new text]
+  def ranges(old_source, new_source, **options)
+    packed = TreeSitter::Diff.diff_ranges(parse(old_source), parse(new_source), **options)
+    packed.unpack("L*").each_slice(5).map do |type, old_start, old_end, new_start, new_end|
+      [TreeSitter::Diff::CHANGE_TYPES.fetch(type), old_source.byteslice(old_start...old_end),
+       new_source.byteslice(new_start...new_end)]
+    end
+  end
+
+  # Asserts that the records of diff_ranges with output_equal: true
+  # spell out both sources token by token
+  def assert_covers(old_source, new_source, records)
+    old_tokens = records.reject { |type, _, _| type == :+ }.flat_map { |_, old_text, _| old_text.split }
+    new_tokens = records.reject { |type, _, _| type == :- }.flat_map { |_, _, new_text| new_text.split }
+    assert_equal old_source.split, old_tokens
+    assert_equal new_source.split, new_tokens
+  end
+
+  # Inserted plus deleted tokens of diff_ranges records
+  def changed_tokens(records)
+    records.sum do |type, old_text, new_text|
+      type == :"=" ? 0 : old_text.split.size + new_text.split.size
+    end
+  end
+end
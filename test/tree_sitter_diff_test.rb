@@ -0,0 +1,408 @@
+# frozen_string_literal: true
+
+require "test_helper"
+require "objspace"
+
+class TreeSitterDiffTest < Minitest::Test
+  include DiffTestHelper
+
+  def test_that_it_has_a_version_number
+    refute_nil ::Tokdiff::VERSION
+  end
+
+  def test_equal_inputs_have_no_changes
+    assert_empty TreeSitter::Diff.diff(parse(OLD_SOURCE), parse(OLD_SOURCE))
+    assert_empty ranges(OLD_SOURCE, OLD_SOURCE)
+  end
+
+  def test_diff_ranges
+    assert_equal [[:-, "2", ""], [:+, "", "5"]], ranges(OLD_SOURCE, NEW_SOURCE)
+    assert_equal [[:!, "2", "5"]], ranges(OLD_SOURCE, NEW_SOURCE, output_replace: true)
+  end
+
+  def test_diff_ranges_of_insertions_and_deletions
+    assert_equal [[:+, "", "int d = 4 ;"]], ranges(OLD_SOURCE, "#{OLD_SOURCE}int d = 4 ;\n")
+    assert_equal [[:-, "int c = 3 ;", ""]], ranges(OLD_SOURCE, OLD_SOURCE.sub("int c = 3 ;\n", ""))
+  end
+
+  def test_diff_ranges_of_a_sub_node
+    old_node = parse(OLD_SOURCE).child(1)
+    new_node = parse("long q ;\nconst int b = 2 ;\n").child(1)
+    records = TreeSitter::Diff.diff_ranges(old_node, new_node).unpack("L*").each_slice(5).to_a
+
+    # an insertion before the first token is placed at the start of the node, not of the source
+    assert_equal [[0, old_node.start_byte, old_node.start_byte, new_node.start_byte, new_node.start_byte + 5]], records
+  end
+
+  def test_diff_ranges_with_equal_tokens
+    types = ranges(OLD_SOURCE, NEW_SOURCE, output_equal: true).map(&:first)
+    assert_equal %i[= - + =], types.chunk_while { |a, b| a == b }.map(&:first)
+  end
+
+  def test_diff_ranges_match_change_sets
+    change_sets = TreeSitter::Diff.diff(parse(OLD_SOURCE), parse(NEW_SOURCE), output_replace: true)
+    assert_equal ranges(OLD_SOURCE, NEW_SOURCE, output_replace: true).map(&:first), change_sets.map(&:type)
+    assert_equal [2], change_sets.map(&:change_count)
+  end
+
+  def test_each_change_yields_the_change_sets_of_diff
+    old_node = parse(OLD_SOURCE)
+    new_node = parse(NEW_SOURCE)
+    yielded = []
+    TreeSitter::Diff.each_change(old_node, new_node) { |change_set| yielded << change_set.type }
+    assert_equal TreeSitter::Diff.diff(old_node, new_node).map(&:type), yielded
+  end
+
+  def test_each_change_without_a_block
+    enum = TreeSitter::Diff.each_change(parse(OLD_SOURCE), parse(NEW_SOURCE))
+    assert_kind_of Enumerator, enum
+    assert_equal %i[- +], enum.map(&:type)
+  end
+
+  def test_each_change_stops_early
+    old_source = (1..200).map { |i| "int a#{i} = #{i} ;\n" }.join
+    new_source = old_source.gsub(/= (\d+) ;/) { "= #{$1.to_i + 1} ;" }
+    first = TreeSitter::Diff.each_change(parse(old_source), parse(new_source)).first
+    assert_equal :-, first.type
+  end
+
+  def test_diff_many_matches_diff
+    sources = [[OLD_SOURCE, NEW_SOURCE], [OLD_SOURCE, OLD_SOURCE], [NEW_SOURCE, "#{NEW_SOURCE}int d = 4 ;\n"]]
+    pairs = sources.map { |old_source, new_source| [parse(old_source), parse(new_source)] }
+    results = TreeSitter::Diff.diff_many(pairs, threads: 2, output_replace: true)
+
+    assert_equal pairs.size, results.size
+    pairs.zip(results).each do |(old_node, new_node), change_sets|
+      expected = TreeSitter::Diff.diff(old_node, new_node, output_replace: true)
+      assert_equal expected.map(&:type), change_sets.map(&:type)
+      assert_equal expected.map(&:change_count), change_sets.map(&:change_count)
+    end
+  end
+
+  def test_diff_many_raises_for_a_bad_pair
+    tokenized = TreeSitter::Diff::TokenizedTree.new(parse(OLD_SOURCE), ignore_whitespace: false)
+    pairs = [[parse(OLD_SOURCE), parse(NEW_SOURCE)], [tokenized, parse(NEW_SOURCE)]]
+    assert_raises(ArgumentError) { TreeSitter::Diff.diff_many(pairs) }
+    assert_raises(ArgumentError) { TreeSitter::Diff.diff_many([[parse(OLD_SOURCE)]]) }
+    assert_raises(ArgumentError) { TreeSitter::Diff.diff_many([], threads: 0) }
+  end
+
+  def test_patience_diff
+    assert_equal ranges(OLD_SOURCE, NEW_SOURCE), ranges(OLD_SOURCE, NEW_SOURCE, algorithm: :patience)
+
+    functions = (1..6).map { |i| "int f#{i} ( ) { return #{i} ; }\n" }
+    old_source = functions.join
+    new_source = functions.rotate(2).join.sub("return 4", "return 40")
+    records = ranges(old_source, new_source, algorithm: :patience, output_equal: true)
+    assert_covers old_source, new_source, records
+    assert(records.any? { |type, _, new_text| type == :+ && new_text.split.include?("40") })
+  end
+
+  def test_unknown_algorithm
+    assert_raises(ArgumentError) { TreeSitter::Diff.diff(parse(OLD_SOURCE), parse(NEW_SOURCE), algorithm: :nope) }
+  end
+
+  def test_histogram_diff
+    assert_equal ranges(OLD_SOURCE, NEW_SOURCE), ranges(OLD_SOURCE, NEW_SOURCE, algorithm: :histogram)
+
+    old_source = (1..40).map { |i| "int v#{i} = #{i % 3} ;\n" }.join
+    new_source = old_source.sub("int v7 = 1 ;\n", "").sub("int v30 = 0 ;", "int v30 = 2 ;")
+    records = ranges(old_source, new_source, algorithm: :histogram, output_equal: true)
+    assert_covers old_source, new_source, records
+    assert(records.any? { |type, old_text, _| type == :- && old_text.split.include?("v7") })
+    assert(records.any? { |type, _, new_text| type == :+ && new_text.split.include?("2") })
+  end
+
+  def test_max_cost_bounds_the_search
+    old_source = (1..50).map { |i| "int v#{i} = #{i} ;\n" }.join
+    new_source = old_source.gsub(/= (\d*[05]) ;/) { "= #{$1.to_i * 2} ;" }
+    exact = ranges(old_source, new_source, output_equal: true)
+    bounded = ranges(old_source, new_source, output_equal: true, max_cost: 1)
+
+    assert_covers old_source, new_source, exact
+    assert_covers old_source, new_source, bounded
+    assert_operator changed_tokens(bounded), :>=, changed_tokens(exact)
+  end
+
+  def test_max_cost_must_be_positive
+    assert_raises(ArgumentError) { TreeSitter::Diff.diff(parse(OLD_SOURCE), parse(NEW_SOURCE), max_cost: 0) }
+  end
+
+  def test_edits_match_the_full_diff
+    old_source = (1..40).map { |i| "int v#{i} = #{i} ;\n" }.join
+    new_source = old_source.sub("int v20 = 20 ;", "int v20 = 200 ;")
+    start_byte = old_source.index("20 ;", old_source.index("v20"))
+    edits = [[start_byte, start_byte + 2, start_byte + 3]]
+
+    assert_equal ranges(old_source, new_source), ranges(old_source, new_source, edits: edits)
+    assert_equal [[:-, "20", ""], [:+, "", "200"]], ranges(old_source, new_source, edits: edits)
+    assert_covers old_source, new_source, ranges(old_source, new_source, output_equal: true, edits: edits)
+  end
+
+  def test_edits_reject_other_strategies
+    edits = [[20, 21, 21]]
+    assert_raises(ArgumentError) { ranges(OLD_SOURCE, NEW_SOURCE, edits: edits, anchor_subtrees: true) }
+    assert_raises(ArgumentError) { ranges(OLD_SOURCE, NEW_SOURCE, edits: edits, split_lines: true) }
+    assert_raises(ArgumentError) { ranges(OLD_SOURCE, NEW_SOURCE, edits: [[5, 4, 6]]) }
+  end
+
+  def test_pq_gram_distance
+    other_source = "int main ( ) { return 0 ; }\n"
+    same = TreeSitter::Diff.pq_gram_distance(parse(OLD_SOURCE), parse(OLD_SOURCE))
+    near = TreeSitter::Diff.pq_gram_distance(parse(OLD_SOURCE), parse(NEW_SOURCE))
+    far = TreeSitter::Diff.pq_gram_distance(parse(OLD_SOURCE), parse(other_source))
+
+    assert_in_delta 0.0, same
+    assert_in_delta far, TreeSitter::Diff.pq_gram_distance(parse(other_source), parse(OLD_SOURCE))
+    assert_operator near, :<, far
+    assert_operator far, :<=, 1.0
+    assert_raises(ArgumentError) { TreeSitter::Diff.pq_gram_distance(parse(OLD_SOURCE), parse(NEW_SOURCE), p: 0) }
+  end
+
+  def test_pq_gram_distance_of_tokenized_trees
+    tokenized = TreeSitter::Diff::TokenizedTree.new(parse(NEW_SOURCE))
+    assert_equal TreeSitter::Diff.pq_gram_distance(parse(OLD_SOURCE), parse(NEW_SOURCE)),
+                 TreeSitter::Diff.pq_gram_distance(parse(OLD_SOURCE), tokenized)
+  end
+
+  def test_pq_gram_distance_of_sub_nodes
+    assert_in_delta 0.0, TreeSitter::Diff.pq_gram_distance(parse(OLD_SOURCE).child(0), parse(NEW_SOURCE).child(0))
+    assert_operator TreeSitter::Diff.pq_gram_distance(parse(OLD_SOURCE).child(1), parse(NEW_SOURCE).child(1)), :>, 0.0
+  end
+
+  def test_packed_pq_profile
+    change_sets = TreeSitter::Diff.diff(parse(OLD_SOURCE), parse(NEW_SOURCE), output_replace: true)
+    change_set = change_sets.first
+    packed = change_set.pq_profile(2, 3, packed: true)
+    grams = packed.unpack("Q<*")
+
+    assert_equal Encoding::BINARY, packed.encoding
+    assert_equal 0, packed.bytesize % 8
+    refute_empty grams
+    assert_equal grams.sort, grams
+    assert_equal packed, change_set.pq_profile(2, 3, packed: true)
+    refute_equal packed, change_set.pq_profile(2, 3, packed: true, pairs: true)
+    assert_operator change_set.pq_profile(2, 3, packed: true, max_depth: 0).bytesize, :<, packed.bytesize
+    assert_raises(ArgumentError) { change_set.pq_profile(2, 3, [], packed: true) }
+  end
+
+  def test_byte_ranges
+    old_source = "int a = 1 ;\n"
+    new_source = "int a = f(x) + 2 ;\n"
+    change_sets = TreeSitter::Diff.diff(parse(old_source), parse(new_source), output_replace: true)
+    old_ranges, new_ranges = change_sets.first.byte_ranges
+
+    assert_equal ["1"], old_ranges.map { |range| old_source.byteslice(range) }
+    assert_equal ["f(x)", "+", "2"], new_ranges.map { |range| new_source.byteslice(range) }
+
+    insertion = TreeSitter::Diff.diff(parse(OLD_SOURCE), parse("#{OLD_SOURCE}int d = 4 ;\n")).first
+    old_ranges, new_ranges = insertion.byte_ranges
+    assert_empty old_ranges
+    assert_equal ["int", "d", "=", "4", ";"], new_ranges.map { |range| "#{OLD_SOURCE}int d = 4 ;\n".byteslice(range) }
+  end
+
+  def test_render
+    change_sets = TreeSitter::Diff.diff(parse(OLD_SOURCE), parse(NEW_SOURCE), output_replace: true)
+    assert_equal "@@ -1,3 +1,3 @@\nint a = 1 ;\nint b = [-2-]{+5+} ;\nint c = 3 ;\n",
+                 TreeSitter::Diff.render(change_sets)
+    assert_equal "@@ -2,1 +2,1 @@\nint b = [-2-]{+5+} ;\n", TreeSitter::Diff.render(change_sets, context: 0)
+    assert_equal "", TreeSitter::Diff.render([])
+  end
+
+  def test_render_splits_hunks
+    old_source = (1..10).map { |i| "int v#{i} = #{i} ;\n" }.join
+    new_source = old_source.sub("v2 = 2", "v2 = 20").sub("v9 = 9", "v9 = 90")
+    change_sets = TreeSitter::Diff.diff(parse(old_source), parse(new_source), output_replace: true)
+
+    assert_equal ["@@ -1,3 +1,3 @@", "@@ -8,3 +8,3 @@"],
+                 TreeSitter::Diff.render(change_sets, context: 1).lines.grep(/^@@/).map(&:chomp)
+  end
+
+  def test_render_rejects_bad_change_sets
+    old_source = (1..10).map { |i| "int v#{i} = #{i} ;\n" }.join
+    new_source = old_source.sub("v2 = 2", "v2 = 20").sub("v9 = 9", "v9 = 90")
+    change_sets = TreeSitter::Diff.diff(parse(old_source), parse(new_source))
+    other = TreeSitter::Diff.diff(parse(OLD_SOURCE), parse(NEW_SOURCE))
+
+    assert_raises(ArgumentError) { TreeSitter::Diff.render(change_sets.reverse) }
+    assert_raises(ArgumentError) { TreeSitter::Diff.render(change_sets + other) }
+    assert_raises(TypeError) { TreeSitter::Diff.render(change_sets + [nil]) }
+  end
+
+  def test_distance
+    assert_equal 0, TreeSitter::Diff.distance(parse(OLD_SOURCE), parse(OLD_SOURCE))
+    assert_equal 2, TreeSitter::Diff.distance(parse(OLD_SOURCE), parse(NEW_SOURCE))
+    assert_equal changed_tokens(ranges(OLD_SOURCE, NEW_SOURCE)),
+                 TreeSitter::Diff.distance(parse(OLD_SOURCE), parse(NEW_SOURCE))
+  end
+
+  def test_distance_with_max
+    assert_equal 2, TreeSitter::Diff.distance(parse(OLD_SOURCE), parse(NEW_SOURCE), max: 2)
+    assert_nil TreeSitter::Diff.distance(parse(OLD_SOURCE), parse(NEW_SOURCE), max: 1)
+    assert_raises(ArgumentError) { TreeSitter::Diff.distance(parse(OLD_SOURCE), parse(NEW_SOURCE), max: -1) }
+  end
+
+  def test_tokenized_tree
+    node = parse(OLD_SOURCE)
+    tokenized = TreeSitter::Diff::TokenizedTree.new(node)
+    assert_equal OLD_SOURCE.split.size, tokenized.size
+    assert_same node, tokenized.node
+  end
+
+  def test_tokenized_tree_diffs_like_its_node
+    old_tokenized = TreeSitter::Diff::TokenizedTree.new(parse(OLD_SOURCE))
+    new_tokenized = TreeSitter::Diff::TokenizedTree.new(parse(NEW_SOURCE))
+    expected = TreeSitter::Diff.diff_ranges(parse(OLD_SOURCE), parse(NEW_SOURCE))
+
+    assert_equal expected, TreeSitter::Diff.diff_ranges(old_tokenized, parse(NEW_SOURCE))
+    assert_equal expected, TreeSitter::Diff.diff_ranges(old_tokenized, new_tokenized)
+    assert_equal 2, TreeSitter::Diff.distance(old_tokenized, new_tokenized)
+  end
+
+  def test_tokenized_tree_options_must_match
+    tokenized = TreeSitter::Diff::TokenizedTree.new(parse(OLD_SOURCE))
+    assert_raises(ArgumentError) { TreeSitter::Diff.diff(tokenized, parse(NEW_SOURCE), ignore_whitespace: false) }
+    assert_raises(ArgumentError) { TreeSitter::Diff.diff(tokenized, parse(NEW_SOURCE), ignore_comments: true) }
+  end
+
+  def test_split_lines_replaces_whole_lines
+    new_source = OLD_SOURCE.sub("int b = 2 ;", "long x [ 4 ]")
+    assert_equal [[:-, "int b = 2 ;", ""], [:+, "", "long x [ 4 ]"]], ranges(OLD_SOURCE, new_source, split_lines: true)
+  end
+
+  def test_split_lines_keeps_changes_within_their_lines
+    old_source = (1..30).map { |i| "int v#{i} = #{i} ;\n" }.join
+    new_source = old_source.sub("int v12 = 12 ;\n", "int v12 = 120 ;\nint w = 0 ;\n").sub("v25 = 25", "v25 = 52")
+    records = ranges(old_source, new_source, split_lines: true, output_equal: true)
+
+    assert_covers old_source, new_source, records
+    assert_equal [[:-, "12", ""], [:+, "", "120"], [:+, "", "int w = 0 ;"], [:-, "25", ""], [:+, "", "52"]],
+                 ranges(old_source, new_source, split_lines: true)
+    # the token level diff lets the inserted tokens straddle a newline
+    refute_includes ranges(old_source, new_source), [:+, "", "int w = 0 ;"]
+  end
+
+  def test_split_lines_rejects_anchor_subtrees
+    assert_raises(ArgumentError) { ranges(OLD_SOURCE, NEW_SOURCE, split_lines: true, anchor_subtrees: true) }
+    assert_raises(ArgumentError) do
+      TreeSitter::Diff.diff_many([[parse(OLD_SOURCE), parse(NEW_SOURCE)]], split_lines: true, anchor_subtrees: true)
+    end
+  end
+
+  def test_anchor_subtrees_keeps_a_moved_subtree
+    body = "return g ( 1 , 2 , 3 , 4 , 5 , 6 , 7 ) ;\n"
+    filler = (1..5).map { |i| "int v#{i} = #{i} ;\n" }.join
+    old_source = "int a = 0 ;\n" + body + filler
+    new_source = "int a = 0 ;\n" + filler + body + "end\n"
+
+    # the longer run of small statements wins without anchoring
+    assert_includes ranges(old_source, new_source), [:-, body.chomp, ""]
+    assert_equal [[:+, "", filler.chomp], [:-, filler.chomp, ""], [:+, "", "end"]],
+                 ranges(old_source, new_source, anchor_subtrees: true)
+    assert_covers old_source, new_source, ranges(old_source, new_source, anchor_subtrees: true, output_equal: true)
+    # the statement is too short to anchor on
+    assert_includes ranges(old_source, new_source, anchor_subtrees: 64), [:-, body.chomp, ""]
+  end
+
+  def test_anchor_subtrees_must_be_positive
+    assert_raises(ArgumentError) { ranges(OLD_SOURCE, NEW_SOURCE, anchor_subtrees: 0) }
+  end
+
+  def test_stats
+    old_source = (1..20).map { |i| "int v#{i} = #{i} ;\n" }.join
+    new_source = old_source.sub("v3 = 3", "v3 = 30").sub("int v9 = 9 ;\n", "").sub("v15", "w15 = v15")
+    records = ranges(old_source, new_source, stats: true)
+    stats = TreeSitter::Diff.last_stats
+
+    assert_equal old_source.split.size, stats[:tokens_old]
+    assert_equal new_source.split.size, stats[:tokens_new]
+    assert_equal changed_tokens(records), stats[:distance]
+    assert_equal TreeSitter::Diff.distance(parse(old_source), parse(new_source)), stats[:distance]
+    assert_operator stats[:prefix_len], :>, 0
+    assert_operator stats[:suffix_len], :>, 0
+    assert_operator stats[:boxes], :>, 0
+    assert_operator stats[:scratch_bytes], :>, 0
+    %i[max_d max_path_len tokenize_ns search_ns output_ns].each { |key| assert_kind_of Integer, stats[key] }
+  end
+
+  def test_last_stats_without_stats
+    last_stats = Thread.new do
+      ranges(OLD_SOURCE, NEW_SOURCE)
+      TreeSitter::Diff.last_stats
+    end.value
+    assert_nil last_stats
+  end
+
+  # Boxes of up to 64 edits are searched forward only, larger ones are bisected first
+  def test_diff_is_minimal_for_few_and_many_edits
+    random = Random.new(7)
+    old_tokens = Array.new(3000) { "t#{random.rand(200)}" }
+    [4, 40, 400].each do |edits|
+      new_tokens = old_tokens.dup
+      edits.times { new_tokens[random.rand(new_tokens.size)] = "x#{random.rand(50)}" }
+      old_source = old_tokens.join(" ") + "\n"
+      new_source = new_tokens.join(" ") + "\n"
+      distance = TreeSitter::Diff.distance(parse(old_source), parse(new_source))
+
+      assert_equal distance, changed_tokens(ranges(old_source, new_source))
+      changes = TreeSitter::Diff.each_change(parse(old_source), parse(new_source)).sum { |change_set| change_set.size }
+      assert_equal distance, changes
+    end
+  end
+
+  def test_change_sets_outlive_the_diff
+    change_sets = TreeSitter::Diff.diff(parse(OLD_SOURCE.dup), parse(NEW_SOURCE.dup), output_replace: true)
+    streamed = TreeSitter::Diff.each_change(parse(OLD_SOURCE.dup), parse(NEW_SOURCE.dup), output_replace: true).to_a
+    GC.start
+
+    byte = OLD_SOURCE.index("2 ;")
+    [change_sets, streamed].each do |kept|
+      assert_equal "@@ -2,1 +2,1 @@\nint b = [-2-]{+5+} ;\n", TreeSitter::Diff.render(kept, context: 0)
+      assert_equal [[byte...byte + 1], [byte...byte + 1]], kept.first.byte_ranges
+    end
+  end
+
+  def test_memsize
+    change_set = TreeSitter::Diff.diff(parse(OLD_SOURCE), parse(NEW_SOURCE)).first
+    assert_operator ObjectSpace.memsize_of(change_set), :>, 0
+
+    # the tokens are reported once, by the arena the change sets share
+    arena_memsize = lambda do |source|
+      change_set = TreeSitter::Diff.diff(parse(source), parse("#{source}int d = 4 ;\n")).first
+      ObjectSpace.reachable_objects_from(change_set).sum { |object| ObjectSpace.memsize_of(object) }
+    end
+    assert_operator arena_memsize.call(OLD_SOURCE * 100), :>, arena_memsize.call(OLD_SOURCE)
+
+    assert_operator ObjectSpace.memsize_of(TreeSitter::Diff::TokenizedTree.new(parse(OLD_SOURCE * 100))), :>,
+                    ObjectSpace.memsize_of(TreeSitter::Diff::TokenizedTree.new(parse(OLD_SOURCE)))
+  end
+
+  # The engine runs without the GVL, an interrupt must still stop it right away
+  def test_interrupting_a_long_diff
+    random = Random.new(3)
+    old_node = parse(Array.new(40_000) { "a#{random.rand(1000)}" }.join(" "))
+    new_node = parse(Array.new(40_000) { "b#{random.rand(1000)}" }.join(" "))
+    diffs = [-> { TreeSitter::Diff.diff(old_node, new_node) },
+             -> { TreeSitter::Diff.diff_many([[old_node, new_node]], threads: 2) }]
+
+    diffs.product(%i[raise kill]).each do |diff, stop|
+      thread = Thread.new do
+        Thread.current.report_on_exception = false
+        diff.call
+      end
+      sleep 0.2
+      start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+      if stop == :raise
+        thread.raise(RuntimeError, "stop")
+        assert_raises(RuntimeError) { thread.join(5) }
+      else
+        thread.kill
+        thread.join(5)
+      end
+
+      refute_predicate thread, :alive?
+      assert_operator Process.clock_gettime(Process::CLOCK_MONOTONIC) - start, :<, 1
+    end
+    assert_equal [[:-, "2", ""], [:+, "", "5"]], ranges(OLD_SOURCE, NEW_SOURCE)
+  end
+end